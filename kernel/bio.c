@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,19 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To start reading a block that will be wanted soon,
+//     without waiting for it, call breadahead.
+// * To write several buffers at once, call bwritestart on
+//     each, then bwait on each before brelse.
+//
+// Buffers are hashed by (dev, blockno), each bucket with its
+// own lock, so that processes using different blocks do not
+// contend. A bucket's lock protects its chain and the
+// refcnt, lastuse, dev and blockno of the buffers on it.
+// Recycling a buffer takes the least recently used free one
+// from the block's own bucket, else from another bucket; no
+// more than one bucket lock is ever held, so there is no
+// global lock and no lock order to get wrong.
 
 
 #include "types.h"
@@ -23,69 +36,158 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define NBUCKET 13
+#define MAXAHEAD (NBUF/4)  // most buffers being read ahead at once
+
+struct bucket {
   struct spinlock lock;
+  struct buf *head;
+};
+
+struct {
   struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  // statistics; unlocked increments, so only roughly right.
+  int nhit;     // bget()s that found the block cached
+  int nmiss;    // bget()s that recycled a buffer
+  int nsteal;   // recycled buffers taken from another bucket
+  int nahead;   // blocks read ahead
+  int nahit;    // of those, later asked for by bread()
+  int nwasted;  // of those, recycled without being asked for
+
+  int nreading; // read-ahead buffers the disk has now
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 7 + blockno) % NBUCKET];
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // spread the buffers over the buckets, as blocks of
+  // device 0, which is never used.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->dev = 0;
+    b->blockno = b - bcache.buf;
+    bk = bhash(b->dev, b->blockno);
+    b->next = bk->head;
+    bk->head = b;
   }
 }
 
+// Take the least recently used free buffer off bucket bk,
+// or return 0.
+static struct buf*
+bsteal(struct bucket *bk)
+{
+  struct buf *b, **pp, **lru;
+
+  acquire(&bk->lock);
+  lru = 0;
+  for(pp = &bk->head; (b = *pp) != 0; pp = &b->next)
+    if(b->refcnt == 0 && (lru == 0 || b->lastuse < (*lru)->lastuse))
+      lru = pp;
+  b = 0;
+  if(lru){
+    b = *lru;
+    *lru = b->next;
+    b->next = 0;
+  }
+  release(&bk->lock);
+  return b;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// For read-ahead (ahead is 1), only a newly allocated buffer
+// is any use, and waiting is not; return 0 instead.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ahead)
 {
-  struct buf *b;
+  struct buf *b, *victim;
+  struct bucket *bk, *v;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head; b; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
+      if(ahead){
+        release(&bk->lock);
+        return 0;
+      }
       b->refcnt++;
-      release(&bcache.lock);
+      release(&bk->lock);
       acquiresleep(&b->lock);
+      bcache.nhit++;
       return b;
     }
   }
+  release(&bk->lock);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached. Recycle a free buffer, from this bucket if
+  // it has one, else from the next one that does.
+  v = bk;
+  while((victim = bsteal(v)) == 0){
+    if(++v == bcache.bucket+NBUCKET)
+      v = bcache.bucket;
+    if(v == bk){
+      if(ahead)
+        return 0;
+      panic("bget: no buffers");
+    }
+  }
+  if(v != bk)
+    bcache.nsteal++;
+  if(victim->ahead){
+    victim->ahead = 0;
+    bcache.nwasted++;
+  }
+
+  // Someone else may have cached the block meanwhile. If so,
+  // use theirs, and leave the victim here, free, as a block
+  // of device 0 that hashes to this bucket.
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  if(b){
+    victim->dev = 0;
+    victim->blockno = bk - bcache.bucket;
+    victim->valid = 0;
+    victim->next = bk->head;
+    bk->head = victim;
+    if(ahead){
+      release(&bk->lock);
+      return 0;
     }
+    b->refcnt++;
+  } else {
+    b = victim;
+    b->dev = dev;
+    b->blockno = blockno;
+    b->valid = 0;
+    b->refcnt = 1;
+    b->next = bk->head;
+    bk->head = b;
+    bcache.nmiss++;
   }
-  panic("bget: no buffers");
+  release(&bk->lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,7 +196,11 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
+  if(b->ahead){
+    b->ahead = 0;
+    bcache.nahit++;
+  }
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,6 +208,35 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading block blockno of dev into the cache, unless
+// it is there already, and return without waiting. Only a
+// hint: if no buffer or no disk request is free, do nothing.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  // each read ahead holds a buffer until the disk is done;
+  // don't let them crowd out buffers others need.
+  if(__sync_fetch_and_add(&bcache.nreading, 1) >= MAXAHEAD)
+    goto out;
+  if((b = bget(dev, blockno, 1)) == 0)
+    goto out;
+  // b is new to the cache, and locked; the disk driver's
+  // interrupt calls breaddone() to let it go.
+  b->ahead = 1;
+  if(virtio_disk_readahead(b) < 0){
+    b->ahead = 0;
+    brelse(b);
+    goto out;
+  }
+  bcache.nahead++;
+  return;
+
+out:
+  __sync_fetch_and_sub(&bcache.nreading, 1);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +246,100 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
-// Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Start writing b's contents to disk, and return without
+// waiting, so that writes of many buffers can be in flight
+// together. b must be locked, and stay so until bwait(b).
 void
-brelse(struct buf *b)
+bwritestart(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
-    panic("brelse");
+    panic("bwritestart");
+  virtio_disk_submit(b, 1);
+}
 
-  releasesleep(&b->lock);
+// Wait for the write started by bwritestart(b) to finish.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  virtio_disk_wait(b);
+}
+
+// Drop a reference to b, noting when it was last used, for
+// recycling.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
 
-  acquire(&bcache.lock);
+  // b's refcnt is not 0, so b stays in its bucket.
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = r_time();
   }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
+}
+
+// Release a locked buffer.
+void
+brelse(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("brelse");
+
+  releasesleep(&b->lock);
+  bput(b);
+}
+
+// A read started by breadahead() has finished; let go of b
+// for the process that started it. Called by the disk
+// driver's interrupt handler.
+void
+breaddone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+  __sync_fetch_and_sub(&bcache.nreading, 1);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
+}
+
+// Format buffer cache statistics into buf, for the
+// statistics device. Returns the number of bytes used.
+int
+bcachestats(char *buf, int sz)
+{
+  struct bucket *bk;
+  uint nts;
+
+  nts = 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    nts += bk->lock.nts;
+  return snprintf(buf, sz, "bcache: hit %d miss %d steal %d lock spins %d\n"
+                  "bcache: read ahead %d hit %d wasted %d\n",
+                  bcache.nhit, bcache.nmiss, bcache.nsteal, nts,
+                  bcache.nahead, bcache.nahit, bcache.nwasted);
 }
 
 
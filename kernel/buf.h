@@ -1,12 +1,13 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int ahead;   // read ahead, and not yet asked for?
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  uint64 lastuse;   // r_time() when last released, for recycling
+  struct buf *next; // next in its bcache bucket
   uchar data[BSIZE];
 };
 
@@ -1,21 +1,31 @@
 struct buf;
 struct context;
 struct file;
+struct files;
 struct inode;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
+struct slab;
 struct stat;
 struct superblock;
+struct timer;
+struct vma;
+struct vmspace;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritestart(struct buf*);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            breadahead(uint, uint);
+void            breaddone(struct buf*);
+int             bcachestats(char*, int);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +34,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execload(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -34,6 +45,10 @@ int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
 
+// futex.c
+void            futexinit(void);
+int             futex(uint64, int, int);
+
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
@@ -43,6 +58,7 @@ struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
+int             ireclaim(void);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -62,7 +78,16 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void*           kzalloc(void);
+int             kzero_fill(void);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
+void            ksplit(void *, int);
+int             kfreecount(void);
+void            kref(void *);
+int             krefcount(void *);
 void            kinit(void);
+int             kallocstats(char*, int);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -81,13 +106,17 @@ void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 
+// sprintf.c
+int             snprintf(char*, int, char*, ...);
+
 // proc.c
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             spawn(char*, char**, int*);
+uint64          growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+void            proc_freepagetable(pagetable_t, uint64, uint64);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
@@ -104,10 +133,25 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             sleepstats(char*, int);
+int             nice(int);
+int             getprocs(uint64, int);
+int             setaffinity(int, uint);
+int             getaffinity(int);
+int             schedstats(char*, int);
+int             schedstat(uint64, int);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
+void            tlbshootdown(struct vmspace*);
+int             filesgrow(struct files*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// ucopy.S
+int             ucopy(char*, char*, uint64);
+int             ucopystr(char*, char*, uint64);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -116,16 +160,27 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// slab.c
+void            slabinit(struct slab*, char*, uint, void (*)(void*));
+void*           slaballoc(struct slab*);
+void            slabfree(struct slab*, void*);
+int             slabstats(char*, int);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// stats.c
+void            statsinit(void);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
 void*           memset(void*, int, uint);
+void            pagecopy(void*, const void*);
+void            pagezero(void*);
 char*           safestrcpy(char*, const char*, int);
 int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
@@ -139,12 +194,30 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// text.c
+void            textinit(void);
+char*           textget(struct inode*, uint, uint);
+void            textadd(struct inode*, uint, uint, char*);
+void            textinval(struct inode*);
+int             textreclaim(void);
+int             textstats(char*, int);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            clockidle(void);
+void            clockbusy(void);
+void            clockkick(int);
+uint64          clocknow(void);
+
+// timer.c
+void            timerstart(struct timer*, uint, void (*)(void*), void*);
+void            timerstop(struct timer*);
+void            timertick(void);
+int             timernext(uint*);
 
 // uart.c
 void            uartinit(void);
@@ -153,24 +226,49 @@ void            uartputc(int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
+// vma.c
+struct vma*     vmafind(struct proc*, uint64);
+int             vmaoverlap(struct proc*, uint64, uint64);
+int             vmafault(struct proc*, uint64);
+int             vmaprefault(struct proc*, uint64, uint64);
+int             vmafill(struct proc*);
+int             vmadup(struct proc*, struct proc*);
+void            vmaclose(struct vma*, pagetable_t);
+uint64          vmabase(struct proc*);
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+pagetable_t     kvmcreate(void);
+void            kvmfree(pagetable_t);
 uint64          kvmpa(uint64);
 void            kvmmap(uint64, uint64, uint64, int);
+void            kvmmapstack(uint64, uint64);
+void            kvmunmapstack(uint64);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+pte_t *         walk(pagetable_t, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmshare(pagetable_t, pagetable_t, uint64, uint64, int);
+int             cowfault(pagetable_t, uint64);
+int             uvmfault(pagetable_t, uint64, int);
+int             uvmsuper(pagetable_t, uint64, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
-void            uvmunmap(pagetable_t, uint64, uint64, int);
-void            uvmclear(pagetable_t, uint64);
+int             uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmsplit(pagetable_t, uint64, uint64);
+int             uvmrevoke(pagetable_t, uint64, uint64);
+int             uvmclear(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
+uint64          uvmaddr(pagetable_t, uint64, int, int*);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             vmstats(char*, int);
 
 // plic.c
 void            plicinit(void);
@@ -181,6 +279,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, int);
+void            virtio_disk_wait(struct buf *);
+int             virtio_disk_readahead(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
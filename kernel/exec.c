@@ -3,23 +3,38 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "vmspace.h"
+#include "fs.h"
+#include "file.h"
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
-
+// Replace the user memory of p, the caller or a new
+// process that spawn() is starting, with the program path.
+// The program's segments are not read in here: each
+// becomes a vma, and its pages are read from the file
+// the first time they are touched (see vmafault()).
+// Returns argc, or -1 with p unchanged.
 int
-exec(char *path, char **argv)
+execload(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG+1], stackbase;
+  int i, off, prot;
+  uint64 argc, sz = 0, sp, ustack[MAXARG+1], stackbase, oldtfva;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vma[NVMA], *v;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+
+  // the other threads would lose their address space.
+  if(p->vm->ref > 1)
+    return -1;
+
+  memset(vma, 0, sizeof(vma));
+  v = vma;
 
   begin_op();
 
@@ -38,7 +53,9 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Describe the program's segments. Segments must be
+  // page-aligned and in increasing order, so that no page
+  // belongs to two of them.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -48,21 +65,35 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr % PGSIZE != 0 || ph.vaddr < PGROUNDUP(sz))
       goto bad;
-    sz = sz1;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.vaddr + ph.memsz > MAXUVA)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
+    if(ph.memsz == 0)
+      continue;
+    if(v == &vma[NVMA])
+      goto bad;
+    prot = PTE_R;
+    if(ph.flags & ELF_PROG_FLAG_WRITE)
+      prot |= PTE_W;
+    if(ph.flags & ELF_PROG_FLAG_EXEC)
+      prot |= PTE_X;
+    v->start = ph.vaddr;
+    v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+    v->ip = idup(ip);
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    v->prot = prot;
+    v++;
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
+  uint64 oldsz = p->vm->sz;
 
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
@@ -71,7 +102,8 @@ exec(char *path, char **argv)
   if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE)) == 0)
     goto bad;
   sz = sz1;
-  uvmclear(pagetable, sz-2*PGSIZE);
+  if(uvmclear(pagetable, sz-2*PGSIZE) < 0)
+    goto bad;
   sp = sz;
   stackbase = sp - PGSIZE;
 
@@ -108,50 +140,38 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
-  // Commit to the user image.
+  // Commit to the user image. p is the only thread, though
+  // perhaps not the first, so its trapframe moves to the
+  // first TRAPFRAMES() slot.
+  acquire(&p->vm->lock);
   oldpagetable = p->pagetable;
-  p->pagetable = pagetable;
-  p->sz = sz;
+  oldtfva = p->tfva;
+  p->vm->pagetable = p->pagetable = pagetable;
+  p->vm->sz = sz;
+  p->vm->tfmap = 1;
+  p->tfva = TRAPFRAME;
+  release(&p->vm->lock);
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  vmaclose(p->vm->vma, oldpagetable);
+  memmove(p->vm->vma, vma, sizeof(vma));
+  proc_freepagetable(oldpagetable, oldtfva, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
-    proc_freepagetable(pagetable, sz);
+    proc_freepagetable(pagetable, TRAPFRAME, sz);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  vmaclose(vma, 0);
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+int
+exec(char *path, char **argv)
 {
-  uint i, n;
-  uint64 pa;
-
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
+  return execload(myproc(), path, argv);
 }
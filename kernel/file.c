@@ -12,35 +12,35 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
+// open files come from a slab as they are needed;
+// the lock protects their reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct slab slab;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  slabinit(&ftable.slab, "file", sizeof(struct file), 0);
 }
 
 // Allocate a file structure.
+// Returns 0 if out of memory.
 struct file*
 filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = slaballoc(&ftable.slab)) == 0)
+    return 0;
+  f->ref = 1;
+  f->type = FD_NONE;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -72,6 +72,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  slabfree(&ftable.slab, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -111,6 +112,11 @@ fileread(struct file *f, uint64 addr, int n)
   if(f->readable == 0)
     return -1;
 
+  // the copy to addr runs with a pipe, console or inode lock
+  // held, so any page of a file it needs must be read in first.
+  if(vmaprefault(myproc(), addr, n) < 0)
+    return -1;
+
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -139,6 +145,11 @@ filewrite(struct file *f, uint64 addr, int n)
   if(f->writable == 0)
     return -1;
 
+  // the copy from addr runs with a pipe, console or inode lock
+  // held, so any page of a file it needs must be read in first.
+  if(vmaprefault(myproc(), addr, n) < 0)
+    return -1;
+
   if(f->type == FD_PIPE){
     ret = pipewrite(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
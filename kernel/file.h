@@ -18,6 +18,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;   // next in icache hash chain
+  struct inode *lnext;   // icache's list of unreferenced inodes
+  struct inode *lprev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -27,6 +30,11 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+
+  // sequential read detection, for readahead().
+  uint ranext;        // block a sequential read would start at
+  uint rawin;         // blocks to read ahead; 0 if not sequential
+  uint raend;         // first block not yet read ahead
 };
 
 // map major device number to device functions.
@@ -38,3 +46,4 @@ struct devsw {
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define STATS   2
@@ -20,6 +20,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
@@ -167,26 +168,68 @@ bfree(int dev, uint b)
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold icache.lock while using any of those fields.
 //
+// Entries come from a slab as they are needed, and are found
+// through a hash of dev and inum. Once unreferenced, up to
+// NINODE of them stay cached, on a list oldest first, in case
+// they are wanted again; beyond that they are freed.
+//
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct slab slab;
+  struct inode *hash[NIHASH];
+  struct inode lru;     // head of the unreferenced entries
+  int nlru;
 } icache;
 
+static void
+inodector(void *o)
+{
+  struct inode *ip = o;
+
+  initsleeplock(&ip->lock, "inode");
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
+  slabinit(&icache.slab, "inode", sizeof(struct inode), inodector);
+  icache.lru.lnext = icache.lru.lprev = &icache.lru;
+}
+
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &icache.hash[(dev * 7 + inum) % NIHASH];
+}
+
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = ihash(ip->dev, ip->inum); *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
   }
 }
 
+static void
+lruremove(struct inode *ip)
+{
+  ip->lprev->lnext = ip->lnext;
+  ip->lnext->lprev = ip->lprev;
+  icache.nlru--;
+}
+
 static struct inode* iget(uint dev, uint inum);
 
 // Allocate an inode on device dev.
@@ -242,31 +285,37 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  pp = ihash(dev, inum);
+  for(ip = *pp; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref == 0)
+        lruremove(ip);
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  // Make a new entry, or if memory is short, recycle
+  // the oldest unreferenced one.
+  if((ip = slaballoc(&icache.slab)) == 0){
+    ip = icache.lru.lnext;
+    if(ip == &icache.lru)
+      panic("iget: no inodes");
+    lruremove(ip);
+    iunhash(ip);
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = *pp;
+  *pp = ip;
   release(&icache.lock);
 
   return ip;
@@ -307,6 +356,7 @@ ilock(struct inode *ip)
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
     ip->valid = 1;
+    ip->ranext = ip->rawin = ip->raend = 0;
     if(ip->type == 0)
       panic("ilock: no type");
   }
@@ -354,7 +404,51 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0){
+    if(ip->valid){
+      // keep it cached, in place of the oldest if too many are.
+      ip->lprev = icache.lru.lprev;
+      ip->lnext = &icache.lru;
+      ip->lprev->lnext = ip;
+      icache.lru.lprev = ip;
+      icache.nlru++;
+      if(icache.nlru > NINODE){
+        ip = icache.lru.lnext;
+        lruremove(ip);
+        iunhash(ip);
+        slabfree(&icache.slab, ip);
+      }
+    } else {
+      iunhash(ip);
+      slabfree(&icache.slab, ip);
+    }
+  }
+  release(&icache.lock);
+}
+
+// Free the cached inodes that no one refers to, so that
+// their slab pages can go back to kalloc(). Called by
+// kalloc() when memory runs out, which iget() may be doing
+// with icache.lock held; then there is nothing to do.
+// Returns the number freed.
+int
+ireclaim(void)
+{
+  struct inode *ip;
+  int n;
+
+  if(holding(&icache.lock))
+    return 0;
+  n = 0;
+  acquire(&icache.lock);
+  while((ip = icache.lru.lnext) != &icache.lru){
+    lruremove(ip);
+    iunhash(ip);
+    slabfree(&icache.slab, ip);
+    n++;
+  }
   release(&icache.lock);
+  return n;
 }
 
 // Common idiom: unlock, then put.
@@ -413,6 +507,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  textinval(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -448,6 +544,42 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+#define RAMIN 2     // blocks read ahead once reads look sequential
+#define RAMAX 16    // most blocks read ahead
+
+// Blocks fb..lb of ip have just been read. If ip's reads
+// look sequential, start reading the blocks after lb, so that
+// they are in the buffer cache, or on their way, by the time
+// they are asked for. The window doubles with each sequential
+// read, up to RAMAX blocks, and closes on any other read.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint fb, uint lb)
+{
+  uint bn, last;
+
+  // a read that starts where the last one stopped, or in
+  // the block it stopped in, is sequential.
+  if(fb == ip->ranext || fb + 1 == ip->ranext){
+    ip->rawin = ip->rawin ? min(2 * ip->rawin, RAMAX) : RAMIN;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = lb + 1;
+  if(ip->rawin == 0)
+    return;
+
+  last = min(lb + ip->rawin, (ip->size - 1) / BSIZE);
+  bn = lb + 1;
+  if(bn < ip->raend)
+    bn = ip->raend;
+  for(; bn <= last; bn++)
+    breadahead(ip->dev, bmap(ip, bn));
+  if(bn > ip->raend)
+    ip->raend = bn;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -455,7 +587,7 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, off0;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -463,6 +595,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  off0 = off;
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -472,6 +605,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     }
     brelse(bp);
   }
+  if(tot > 0)
+    readahead(ip, off0/BSIZE, (off0 + tot - 1)/BSIZE);
   return tot;
 }
 
@@ -490,6 +625,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  // any cached text of this file is about to go stale.
+  if(n > 0)
+    textinval(ip);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -629,8 +768,13 @@ namex(char *path, int nameiparent, char *name)
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    // another thread may chdir() meanwhile.
+    struct files *files = myproc()->files;
+    acquire(&files->lock);
+    ip = idup(files->cwd);
+    release(&files->lock);
+  }
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
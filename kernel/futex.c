@@ -0,0 +1,135 @@
+//
+// Futexes: sleeping and waking on a word of user memory,
+// for user-space locks that enter the kernel only when they
+// are contended. A waiter is keyed by the physical address of
+// its word, so that threads, and processes sharing a page
+// through mmap(MAP_SHARED), meet on the same key wherever the
+// page is mapped. Waiters are hashed by key into NFUTEX
+// chains; a chain's lock is held from checking the word to
+// going to sleep, so a FUTEX_WAKE cannot slip in between.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define NFUTEX 31
+
+struct futexwait {
+  uint64 key;              // physical address of the word
+  int woken;
+  struct futexwait *next;
+};
+
+static struct {
+  struct spinlock lock;
+  struct futexwait *head;
+} futexq[NFUTEX];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEX; i++)
+    initlock(&futexq[i].lock, "futex");
+}
+
+// Sleep until a FUTEX_WAKE on the word at user address addr,
+// if it still holds val. Returns 0 when woken, -1 if the word
+// held something else, addr is bad, or the process is killed.
+static int
+futexwait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct futexwait w, **wp;
+  struct spinlock *lk;
+  uint64 pa;
+  int pinned;
+
+  // the page is made writable, breaking copy-on-write, so
+  // that a forked child does not share the key.
+  if((pa = uvmaddr(p->pagetable, PGROUNDDOWN(addr), 1, &pinned)) == 0)
+    return -1;
+  w.key = pa + (addr - PGROUNDDOWN(addr));
+  w.woken = 0;
+  w.next = 0;
+  lk = &futexq[w.key % NFUTEX].lock;
+
+  acquire(lk);
+  if(*(volatile int*)w.key != val){
+    release(lk);
+    if(pinned)
+      kfree((void*)pa);
+    return -1;
+  }
+  if(pinned)
+    kfree((void*)pa);
+  // join the end of the chain, so waiters are woken in turn.
+  for(wp = &futexq[w.key % NFUTEX].head; *wp; wp = &(*wp)->next)
+    ;
+  *wp = &w;
+  while(!w.woken && !p->killed)
+    sleep(&w, lk);
+  if(!w.woken){
+    // killed: take w off the chain ourselves.
+    for(wp = &futexq[w.key % NFUTEX].head; *wp; wp = &(*wp)->next){
+      if(*wp == &w){
+        *wp = w.next;
+        break;
+      }
+    }
+  }
+  release(lk);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n waiters on the word at user address addr.
+// Returns the number woken, or -1 if addr is bad.
+static int
+futexwake(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct futexwait *w, **wp;
+  uint64 pa, key;
+  int pinned, woken;
+
+  if((pa = uvmaddr(p->pagetable, PGROUNDDOWN(addr), 1, &pinned)) == 0)
+    return -1;
+  key = pa + (addr - PGROUNDDOWN(addr));
+  if(pinned)
+    kfree((void*)pa);
+
+  woken = 0;
+  acquire(&futexq[key % NFUTEX].lock);
+  for(wp = &futexq[key % NFUTEX].head; (w = *wp) != 0 && woken < n; ){
+    if(w->key != key){
+      wp = &w->next;
+      continue;
+    }
+    *wp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  release(&futexq[key % NFUTEX].lock);
+  return woken;
+}
+
+int
+futex(uint64 addr, int op, int val)
+{
+  if(addr % sizeof(int) != 0)
+    return -1;
+  switch(op){
+  case FUTEX_WAIT:
+    return futexwait(addr, val);
+  case FUTEX_WAKE:
+    return futexwake(addr, val);
+  }
+  return -1;
+}
@@ -1,6 +1,33 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers.
+//
+// Underneath is a binary buddy allocator: free memory is kept
+// as blocks of 2^order pages, for order 0..MAXORDER, each
+// aligned (relative to KERNBASE) to its own size. Allocating
+// splits a larger block when needed; freeing a block merges it
+// with its buddy whenever the buddy is free too.
+// kalloc_pages(order) hands out physically contiguous blocks.
+//
+// Every allocated block has a reference count, kept for its
+// first page. kalloc() starts it at 1, kref() adds a reference,
+// and kfree() only frees the page when the last one is dropped.
+// That lets copy-on-write fork share pages between processes.
+// ksplit() turns a block into pages counted one by one, so that
+// a user superpage can later be unmapped, or copied on write,
+// a page at a time.
+//
+// kalloc() and kfree() are the order-0 fast path. Each CPU
+// keeps a small cache of free pages, so that the common case
+// only takes that CPU's lock. A cache refills from the buddy
+// allocator, and drains back to it, KBATCH pages at a time.
+// When both a CPU's cache and the buddy allocator are empty,
+// kalloc() steals half of some other CPU's cache.
+//
+// Built with KJUNK defined, freed and newly allocated pages are
+// filled with junk to catch dangling references. Otherwise pages
+// are handed out as they are, and idle CPUs keep a small pool of
+// pages zeroed ahead of time for kzalloc().
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +36,14 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KBATCHORDER 5
+#define KBATCH    (1 << KBATCHORDER)  // pages moved per refill or drain
+#define KCACHEMAX (2*KBATCH)          // drain a cache that grows beyond this
+
+#define NPAGE     ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PG2PA(i)  (KERNBASE + (uint64)(i) * PGSIZE)
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -16,27 +51,248 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev; // only used on the buddy free lists
 };
 
+// the buddy allocator.
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run freelist[MAXORDER+1]; // circular list of free blocks, per order
+  int nblock[MAXORDER+1];          // number of free blocks, per order
+  int nfree;                       // free pages, in all orders
+  int nsplit;                      // blocks split to satisfy an allocation
+  int nmerge;                      // buddies merged on free
+  int nfail;                       // kalloc_pages() calls that failed
+
+  // per-page state, indexed by PA2PG().
+  uchar isfree[NPAGE]; // is this page the head of a free block?
+  uchar order[NPAGE];  // order of the block that starts at this page
+  int ref[NPAGE];      // references to an allocated block; atomic
 } kmem;
 
+// per-CPU caches of free pages.
+// the counters are protected by the cache's lock.
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+
+  int nalloc;   // kalloc() calls on this CPU
+  int nhit;     // of those, served straight from the cache
+  int nrefill;  // refills from the buddy allocator
+  int nsteal;   // pages stolen from other CPUs' caches
+  int ndrain;   // drains to the buddy allocator
+} kcache[NCPU];
+
+#ifndef KJUNK
+#define KZEROMAX   64  // pages to keep zeroed ahead of time
+#define KZEROBATCH 8   // pages zeroed per kzero_fill() call
+
+// pages zeroed by idle CPUs, for kzalloc().
+// only the next pointer is written in a pooled page,
+// so clearing it leaves the page all zero again.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+
+  int nhit;   // kzalloc() calls served from the pool
+  int nmiss;  // kzalloc() calls that had to zero a page
+  int nfill;  // pages zeroed by idle CPUs
+} kzero;
+#endif
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  for(int k = 0; k <= MAXORDER; k++){
+    kmem.freelist[k].next = &kmem.freelist[k];
+    kmem.freelist[k].prev = &kmem.freelist[k];
+  }
+  for(struct kcache *kc = kcache; kc < &kcache[NCPU]; kc++)
+    initlock(&kc->lock, "kcache");
+#ifndef KJUNK
+  initlock(&kzero.lock, "kzero");
+#endif
   freerange(end, (void*)PHYSTOP);
 }
 
+static void buddy_free(uint64 i, int order);
+
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
+  acquire(&kmem.lock);
   for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+    buddy_free(PA2PG(p), 0);
+  release(&kmem.lock);
+}
+
+static void
+list_push(struct run *head, struct run *r)
+{
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+}
+
+static void
+list_remove(struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+}
+
+// Put the block of 2^order pages starting at page i on the
+// free lists, merging it with its buddy as far as possible.
+// Caller must hold kmem.lock.
+static void
+buddy_free(uint64 i, int order)
+{
+  uint64 buddy;
+
+  kmem.nfree += 1 << order;
+  while(order < MAXORDER){
+    buddy = i ^ (1L << order);
+    if(buddy >= NPAGE || !kmem.isfree[buddy] || kmem.order[buddy] != order)
+      break;
+    list_remove((struct run*)PG2PA(buddy));
+    kmem.isfree[buddy] = 0;
+    kmem.nblock[order]--;
+    kmem.nmerge++;
+    i &= ~(1L << order);
+    order++;
+  }
+  kmem.isfree[i] = 1;
+  kmem.order[i] = order;
+  kmem.nblock[order]++;
+  list_push(&kmem.freelist[order], (struct run*)PG2PA(i));
+}
+
+// Take a block of 2^order pages off the free lists,
+// splitting a larger block if need be.
+// Returns its first page number, or -1 if there is none.
+// Caller must hold kmem.lock.
+static int
+buddy_alloc(int order)
+{
+  struct run *r;
+  uint64 i;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(kmem.nblock[k] > 0)
+      break;
+  if(k > MAXORDER)
+    return -1;
+
+  r = kmem.freelist[k].next;
+  list_remove(r);
+  i = PA2PG(r);
+  kmem.isfree[i] = 0;
+  kmem.nblock[k]--;
+
+  // give back the upper halves we don't need.
+  while(k > order){
+    k--;
+    kmem.isfree[i + (1L << k)] = 1;
+    kmem.order[i + (1L << k)] = k;
+    kmem.nblock[k]++;
+    list_push(&kmem.freelist[k], (struct run*)PG2PA(i + (1L << k)));
+    kmem.nsplit++;
+  }
+  kmem.order[i] = order;
+  kmem.nfree -= 1 << order;
+  return i;
+}
+
+// Detach up to n pages from the front of *list.
+// Returns the detached chain and stores its length in *got.
+static struct run*
+takepages(struct run **list, int n, int *got)
+{
+  struct run *head, *r;
+  int i;
+
+  head = *list;
+  if(head == 0){
+    *got = 0;
+    return 0;
+  }
+  for(i = 1, r = head; i < n && r->next; i++)
+    r = r->next;
+  *list = r->next;
+  r->next = 0;
+  *got = i;
+  return head;
+}
+
+// Give a chain of order-0 pages back to the buddy allocator.
+static void
+kdrain(struct run *chain)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(chain){
+    r = chain;
+    chain = r->next;
+    buddy_free(PA2PG(r), 0);
+  }
+  release(&kmem.lock);
+}
+
+// Take one page from the pool of zeroed pages, or return 0.
+static struct run*
+kzero_take(void)
+{
+#ifdef KJUNK
+  return 0;
+#else
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  if(r){
+    kzero.freelist = r->next;
+    kzero.nfree--;
+  }
+  release(&kzero.lock);
+  if(r)
+    r->next = 0;
+  return r;
+#endif
+}
+
+// Empty every CPU's cache, and the pool of zeroed pages,
+// into the buddy allocator, so that those pages can merge
+// into larger blocks.
+static void
+kflush(void)
+{
+  struct kcache *kc;
+  struct run *chain;
+
+  for(kc = kcache; kc < &kcache[NCPU]; kc++){
+    acquire(&kc->lock);
+    chain = kc->freelist;
+    kc->freelist = 0;
+    kc->nfree = 0;
+    release(&kc->lock);
+    kdrain(chain);
+  }
+#ifndef KJUNK
+  acquire(&kzero.lock);
+  chain = kzero.freelist;
+  kzero.freelist = 0;
+  kzero.nfree = 0;
+  release(&kzero.lock);
+  kdrain(chain);
+#endif
 }
 
 // Free the page of physical memory pointed at by v,
@@ -46,20 +302,110 @@ freerange(void *pa_start, void *pa_end)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *chain;
+  struct kcache *kc;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  // only the last reference frees the page.
+  if((n = __sync_sub_and_fetch(&kmem.ref[PA2PG(pa)], 1)) > 0)
+    return;
+  if(n < 0)
+    panic("kfree: ref");
+
+#ifdef KJUNK
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
+  chain = 0;
+
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->nfree++;
+  if(kc->nfree > KCACHEMAX){
+    chain = takepages(&kc->freelist, KBATCH, &n);
+    kc->nfree -= n;
+    kc->ndrain++;
+  }
+  release(&kc->lock);
+  pop_off();
+
+  if(chain)
+    kdrain(chain);
+}
 
+// Find more pages for an empty cache kc, first from
+// the buddy allocator, then by stealing from other CPUs.
+// Returns one page for the caller and puts any others
+// in kc. Called without kc->lock held, so that at most
+// one cache lock is ever held at a time.
+static struct run*
+krefill(struct kcache *kc)
+{
+  struct run *chain, *r;
+  struct kcache *victim;
+  int i, j, n, stolen;
+
+  // prefer carving a whole batch out of one block; fall
+  // back to single pages when memory is fragmented.
+  chain = 0;
+  n = 0;
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  if((i = buddy_alloc(KBATCHORDER)) >= 0){
+    for(j = KBATCH-1; j >= 0; j--){
+      kmem.order[i+j] = 0;
+      r = (struct run*)PG2PA(i+j);
+      r->next = chain;
+      chain = r;
+    }
+    n = KBATCH;
+  } else {
+    for(; n < KBATCH && (i = buddy_alloc(0)) >= 0; n++){
+      r = (struct run*)PG2PA(i);
+      r->next = chain;
+      chain = r;
+    }
+  }
   release(&kmem.lock);
+
+  stolen = 0;
+  for(victim = kcache; chain == 0 && victim < &kcache[NCPU]; victim++){
+    if(victim == kc)
+      continue;
+    acquire(&victim->lock);
+    if(victim->nfree > 0){
+      chain = takepages(&victim->freelist, (victim->nfree + 1) / 2, &n);
+      victim->nfree -= n;
+      stolen = n;
+    }
+    release(&victim->lock);
+  }
+
+  if(chain == 0)
+    return 0;
+
+  acquire(&kc->lock);
+  if(stolen)
+    kc->nsteal += stolen;
+  else
+    kc->nrefill++;
+  if(chain->next){
+    for(r = chain->next; r->next; r = r->next)
+      ;
+    r->next = kc->freelist;
+    kc->freelist = chain->next;
+    kc->nfree += n - 1;
+  }
+  release(&kc->lock);
+
+  return chain;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +415,239 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kcache *kc;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  kc->nalloc++;
+  r = kc->freelist;
+  if(r){
+    kc->freelist = r->next;
+    kc->nfree--;
+    kc->nhit++;
+  }
+  release(&kc->lock);
+  if(r == 0)
+    r = krefill(kc);
+  pop_off();
+
+  // as a last resort, use a page that was zeroed ahead of time,
+  // or give back cached program text that nothing maps, or
+  // the slab pages of cached inodes that no one uses.
+  if(r == 0)
+    r = kzero_take();
+  if(r == 0 && (textreclaim() > 0 || ireclaim() > 0))
+    return kalloc();
   if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+    kmem.ref[PA2PG(r)] = 1;
 
+#ifdef KJUNK
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Allocate one zeroed 4096-byte page of physical memory.
+// Returns 0 if the memory cannot be allocated.
+void *
+kzalloc(void)
+{
+  struct run *r;
+
+  if((r = kzero_take()) != 0){
+    kmem.ref[PA2PG(r)] = 1;
+#ifndef KJUNK
+    __sync_fetch_and_add(&kzero.nhit, 1);
+#endif
+    return (void*)r;
+  }
+#ifndef KJUNK
+  __sync_fetch_and_add(&kzero.nmiss, 1);
+#endif
+  if((r = kalloc()) != 0)
+    pagezero(r);
   return (void*)r;
 }
+
+// Zero a few free pages into the pool used by kzalloc().
+// Called by idle CPUs in scheduler(). Returns the number of
+// pages zeroed, so 0 means there is nothing more to do.
+int
+kzero_fill(void)
+{
+#ifdef KJUNK
+  return 0;
+#else
+  struct run *r;
+  int n;
+
+  for(n = 0; n < KZEROBATCH; n++){
+    // unlocked reads: only a hint. leave memory that is
+    // running short to kalloc().
+    if(kzero.nfree >= KZEROMAX || kmem.nfree < 4*KZEROMAX)
+      break;
+    if((r = kalloc()) == 0)
+      break;
+    pagezero(r);
+    acquire(&kzero.lock);
+    r->next = kzero.freelist;
+    kzero.freelist = r;
+    kzero.nfree++;
+    kzero.nfill++;
+    release(&kzero.lock);
+  }
+  return n;
+#endif
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to 2^order pages. Returns 0 if no such block is free.
+void *
+kalloc_pages(int order)
+{
+  int i;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > MAXORDER)
+    panic("kalloc_pages");
+
+  acquire(&kmem.lock);
+  i = buddy_alloc(order);
+  release(&kmem.lock);
+
+  if(i < 0){
+    // pages sitting in per-CPU caches may be what keeps
+    // a large enough block from forming.
+    kflush();
+    acquire(&kmem.lock);
+    if((i = buddy_alloc(order)) < 0)
+      kmem.nfail++;
+    release(&kmem.lock);
+    if(i < 0)
+      return 0;
+  }
+
+  kmem.ref[i] = 1;
+#ifdef KJUNK
+  memset((char*)PG2PA(i), 5, PGSIZE << order); // fill with junk
+#endif
+  return (void*)PG2PA(i);
+}
+
+// Free a block returned by kalloc_pages(order).
+void
+kfree_pages(void *pa, int order)
+{
+  uint64 i;
+
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  i = PA2PG(pa);
+  if(order < 0 || order > MAXORDER || (i & ((1L << order) - 1)) != 0 ||
+     (char*)pa < end || (uint64)pa >= PHYSTOP || kmem.order[i] != order)
+    panic("kfree_pages");
+
+  if(__sync_sub_and_fetch(&kmem.ref[i], 1) > 0)
+    return;
+
+#ifdef KJUNK
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  buddy_free(i, order);
+  release(&kmem.lock);
+}
+
+// Add a reference to the allocated page (or block) at pa.
+void
+kref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kref");
+  if(__sync_fetch_and_add(&kmem.ref[PA2PG(pa)], 1) < 1)
+    panic("kref: free page");
+}
+
+// Turn the block of 2^order pages at pa, from kalloc_pages(),
+// into 2^order separately allocated pages, each with the
+// block's reference count, which kfree() frees one by one.
+void
+ksplit(void *pa, int order)
+{
+  uint64 i, j;
+  int ref;
+
+  i = PA2PG(pa);
+  if(order < 0 || order > MAXORDER || kmem.order[i] != order)
+    panic("ksplit");
+  ref = kmem.ref[i];
+  for(j = 0; j < (1L << order); j++){
+    kmem.order[i+j] = 0;
+    kmem.ref[i+j] = ref;
+  }
+}
+
+// Roughly how many pages are free in the buddy allocator?
+// (Pages in per-CPU caches are not counted.)
+int
+kfreecount(void)
+{
+  return kmem.nfree;
+}
+
+// How many references are there to the page at pa?
+int
+krefcount(void *pa)
+{
+  return kmem.ref[PA2PG(pa)];
+}
+
+// Format allocator statistics into buf, for the
+// statistics device. Returns the number of bytes used.
+int
+kallocstats(char *buf, int sz)
+{
+  struct kcache *kc;
+  int n, k, big, cached;
+
+  cached = 0;
+  for(kc = kcache; kc < &kcache[NCPU]; kc++){
+    if(kc->nalloc == 0 && kc->nfree == 0 && kc->ndrain == 0)
+      continue;
+    cached += kc->nfree;
+  }
+
+  n = snprintf(buf, sz, "kalloc: buddy free %d cached %d split %d merge %d fail %d\n",
+               kmem.nfree, cached, kmem.nsplit, kmem.nmerge, kmem.nfail);
+  for(kc = kcache; kc < &kcache[NCPU]; kc++){
+    if(kc->nalloc == 0 && kc->nfree == 0 && kc->ndrain == 0)
+      continue;
+    n += snprintf(buf+n, sz-n,
+                  "kalloc: cpu %d: free %d alloc %d hit %d refill %d steal %d drain %d contention %d\n",
+                  (int)(kc - kcache), kc->nfree, kc->nalloc, kc->nhit,
+                  kc->nrefill, kc->nsteal, kc->ndrain, kc->lock.nts);
+  }
+
+#ifndef KJUNK
+  n += snprintf(buf+n, sz-n, "kalloc: zeroed %d hit %d miss %d fill %d\n",
+                kzero.nfree, kzero.nhit, kzero.nmiss, kzero.nfill);
+#endif
+
+  // fragmentation: how much of the free memory sits in blocks
+  // too small to satisfy a request of each order.
+  big = 0;
+  for(k = MAXORDER; k >= 0; k--){
+    big += kmem.nblock[k] << k;
+    n += snprintf(buf+n, sz-n, "kalloc: order %d: blocks %d unusable %d%%\n",
+                  k, kmem.nblock[k],
+                  kmem.nfree ? (kmem.nfree - big) * 100 / kmem.nfree : 0);
+  }
+  return n;
+}
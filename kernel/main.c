@@ -20,6 +20,7 @@ main()
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
+    futexinit();     // futex wait queues
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
@@ -27,6 +28,8 @@ main()
     binit();         // buffer cache
     iinit();         // inode cache
     fileinit();      // file table
+    statsinit();     // statistics device
+    textinit();      // text page cache
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
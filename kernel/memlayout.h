@@ -30,6 +30,10 @@
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
+// qemu's CLINT counts mtime at 10 MHz.
+#define TIMEBASE 10000000L
+#define TICKINTERVAL (TIMEBASE / TICKHZ) // mtime cycles per clock tick
+
 // qemu puts programmable interrupt controller here.
 #define PLIC 0x0c000000L
 #define PLIC_PRIORITY (PLIC + 0x0)
@@ -55,6 +59,13 @@
 // each surrounded by invalid guard pages.
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
 
+// map the CLINT beneath the kernel stacks, where every
+// process's kernel page table has it too, so that the
+// kernel can program timer interrupts.
+#define KCLINT (KSTACK(NPROC) - 0x10000)
+#define KCLINT_MTIMECMP(hartid) (KCLINT + 0x4000 + 8*(hartid))
+#define KCLINT_MTIME (KCLINT + 0xBFF8)
+
 // User memory layout.
 // Address zero first:
 //   text
@@ -62,6 +73,20 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   TRAPFRAMES (other threads' p->trapframe)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// the threads of a process share its page table, so each
+// has its own slot for its trapframe. slot 0 is TRAPFRAME.
+#define TRAPFRAMES(i) (TRAPFRAME - (i)*PGSIZE)
+
+// the top of the memory a program may use. Built with
+// KUSERMAP, each process's kernel page table maps its
+// user memory too, which must then stay below the devices.
+#ifdef KUSERMAP
+#define MAXUVA PLIC
+#else
+#define MAXUVA TRAPFRAMES(NTHREAD-1)
+#endif
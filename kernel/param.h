@@ -1,13 +1,22 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      4096  // maximum number of processes, for kernel stack space
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NOFILE       16  // open files per process before its table grows
+#define MAXOFILE    512  // open files per process, at most a page of pointers
+#define NINODE       50  // unused i-nodes kept cached
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*6)  // size of disk block cache
+#define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER     10    // largest block kalloc_pages() hands out, as log2(pages)
+#define NVMA         16    // file-backed memory areas per process
+#define NTHREAD      16    // threads per process
+#define NICEMIN     -20    // highest scheduling priority
+#define NICEMAX      19    // lowest scheduling priority
+#define NSCHEDHIST   24    // log2 buckets in each scheduling histogram
+#ifndef TICKHZ
+#define TICKHZ       10    // clock ticks per second; make TICKHZ=n to change
+#endif
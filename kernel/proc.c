@@ -3,45 +3,193 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "vmspace.h"
+#include "slab.h"
 #include "defs.h"
+#include "procinfo.h"
+#include "schedstat.h"
+#include "fcntl.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+#define ALLCPUS ((1 << NCPU) - 1)
+
+// CPUs that have started scheduling, bit i for cpus[i].
+static uint cpuson;
+
+// Processes come from a slab as they are needed, and go
+// back to it once reaped, when their memory may be given
+// back to kalloc(). Code that finds a process other than
+// through a reference it holds, such as its child list,
+// must do so through findproc() or pidhash[] under pid_lock.
+static struct slab procslab;
+
+// Each process has a kernel stack, in one of the KSTACK()
+// slots, from when it is made until it is reaped; freed
+// slots are used again first. kstackgen counts the stacks
+// mapped, so that a CPU knows to flush its TLB, which may
+// remember the slot as unmapped or as an older stack.
+static struct spinlock kstack_lock;
+static int nkstack;         // slots used so far
+static int kstackslots[NPROC]; // freed slots
+static int nkstackslot;
+static uint kstackgen;
 
 struct proc *initproc;
 
+// address spaces and open file tables, each shared by
+// the threads of one process.
+static struct slab vmslab;
+static struct slab filesslab;
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// Processes by pid, so that kill() need not search every
+// process; ps and procdump() walk it too. pid_lock protects
+// the chains and the p->pidnext links. Acquire it before any
+// p->lock: a process leaves pidhash[] before it is freed.
+#define NPIDHASH 1024
+static struct proc *pidhash[NPIDHASH];
+
+// Protects every p->parent, the lists of children, and
+// p->thread, and makes sure a parent's wakeup in wait() is
+// not lost. Acquire it before any p->lock.
+struct spinlock wait_lock;
+
+#define NSLEEPQ 61
+
+// Sleeping processes, hashed by channel, so that wakeup()
+// only looks at processes that may be sleeping on its
+// channel. A queue's lock protects its chain and the
+// p->sqnext links in it.
+static struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
+static struct {
+  int nwakeup;    // wakeup() calls
+  int nwasted;    // wakeup() calls that woke no process
+  int nwoken;     // processes woken by wakeup()
+} sleepstat;
+
+// How much CPU time a process gets for each nice value,
+// relative to the others, from NICEMIN to NICEMAX. Each
+// step is worth about 25%.
+static const int niceweight[NICEMAX - NICEMIN + 1] = {
+  /* -20 */ 88761, 71755, 56483, 46273, 36291,
+  /* -15 */ 29154, 23254, 18705, 14949, 11916,
+  /* -10 */ 9548, 7620, 6100, 4904, 3906,
+  /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+  /*   0 */ 1024, 820, 655, 526, 423,
+  /*   5 */ 335, 272, 215, 172, 137,
+  /*  10 */ 110, 87, 70, 56, 45,
+  /*  15 */ 36, 29, 23, 18, 15,
+};
+#define NICE0WEIGHT 1024
+
+// The most vruntime a process that has been sleeping can be
+// behind the others on its run queue when it wakes up.
+#define SLEEPCREDIT TICKINTERVAL
+
 extern void forkret(void);
-static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
+static void setrunnable(struct proc *p);
+static void charge(struct proc *p);
+static void vmput(struct proc *p);
+static void filesput(struct proc *p);
+static void adopt(struct proc *p, struct proc *np, int thread);
+static int reap(int thread, int pid, uint64 addr);
 
 extern char trampoline[]; // trampoline.S
 
+// Set up a struct proc freshly carved from procslab.
+static void
+procctor(void *o)
+{
+  struct proc *p = o;
+
+  initlock(&p->lock, "proc");
+}
+
+static void
+vmctor(void *o)
+{
+  struct vmspace *vm = o;
+
+  initlock(&vm->lock, "vmspace");
+  initsleeplock(&vm->maplock, "maplock");
+}
+
+static void
+filesctor(void *o)
+{
+  struct files *f = o;
+
+  initlock(&f->lock, "files");
+}
+
 // initialize the proc table at boot time.
 void
 procinit(void)
 {
-  struct proc *p;
+  struct cpu *c;
+  struct sleepq *q;
   
   initlock(&pid_lock, "nextpid");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
+  initlock(&wait_lock, "wait_lock");
+  initlock(&kstack_lock, "kstack");
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->rqlock, "runq");
+  for(q = sleepq; q < &sleepq[NSLEEPQ]; q++)
+    initlock(&q->lock, "sleepq");
+  slabinit(&procslab, "proc", sizeof(struct proc), procctor);
+  slabinit(&vmslab, "vmspace", sizeof(struct vmspace), vmctor);
+  slabinit(&filesslab, "files", sizeof(struct files), filesctor);
+}
+
+// Allocate a page for p's kernel stack, and map it high in
+// memory, followed by an invalid guard page, in a free slot.
+// Returns 0, or -1 if memory or slots run out.
+static int
+kstackalloc(struct proc *p)
+{
+  char *pa;
+  int n;
 
-      // Allocate a page for the process's kernel stack.
-      // Map it high in memory, followed by an invalid
-      // guard page.
-      char *pa = kalloc();
-      if(pa == 0)
-        panic("kalloc");
-      uint64 va = KSTACK((int) (p - proc));
-      kvmmap(va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-      p->kstack = va;
+  if((pa = kalloc()) == 0)
+    return -1;
+  acquire(&kstack_lock);
+  if(nkstackslot > 0)
+    n = kstackslots[--nkstackslot];
+  else
+    n = nkstack < NPROC ? nkstack++ : -1;
+  release(&kstack_lock);
+  if(n < 0){
+    kfree(pa);
+    return -1;
   }
-  kvminithart();
+  kvmmapstack(KSTACK(n), (uint64)pa);
+  p->kstack = KSTACK(n);
+  __sync_fetch_and_add(&kstackgen, 1);
+  return 0;
+}
+
+// Unmap and free p's kernel stack, which no CPU is using,
+// and give back its slot.
+static void
+kstackfree(struct proc *p)
+{
+  if(p->kstack == 0)
+    return;
+  kvmunmapstack(p->kstack);
+  acquire(&kstack_lock);
+  kstackslots[nkstackslot++] = (TRAMPOLINE - p->kstack) / (2*PGSIZE) - 1;
+  release(&kstack_lock);
+  p->kstack = 0;
 }
 
 // Must be called with interrupts disabled,
@@ -73,53 +221,91 @@ myproc(void) {
   return p;
 }
 
-int
-allocpid() {
-  int pid;
+// Give p the next pid, and enter it in pidhash[].
+static void
+allocpid(struct proc *p) {
+  struct proc **pp;
   
   acquire(&pid_lock);
-  pid = nextpid;
+  p->pid = nextpid;
   nextpid = nextpid + 1;
+  pp = &pidhash[p->pid % NPIDHASH];
+  p->pidnext = *pp;
+  *pp = p;
   release(&pid_lock);
+}
 
-  return pid;
+// Take p out of pidhash[].
+static void
+freepid(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&pid_lock);
+  for(pp = &pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  p->pidnext = 0;
+  release(&pid_lock);
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// Find the process with the given pid, and return it with
+// p->lock held, or return 0. Holding p->lock keeps it from
+// being freed.
 static struct proc*
-allocproc(void)
+findproc(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&pid_lock);
+  for(p = pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  if(p)
     acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
-  }
-  return 0;
+  release(&pid_lock);
+  return p;
+}
 
-found:
-  p->pid = allocpid();
+// Allocate an UNUSED proc, initialize state required to run
+// in the kernel, and return with p->lock held. The caller gives
+// it user memory, with vmcreate() or by sharing another's.
+// If a memory allocation fails, return 0.
+static struct proc*
+allocproc(void)
+{
+  struct proc *p;
+
+  if((p = slaballoc(&procslab)) == 0)
+    return 0;
+  if(p->state != UNUSED)
+    panic("allocproc");
+  // no one else can find p until allocpid().
+  p->cpu = -1;
+  p->cpumask = ALLCPUS;
+  p->rqindex = -1;
+  if(kstackalloc(p) < 0){
+    freeproc(p);
+    return 0;
+  }
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
-    release(&p->lock);
+    freeproc(p);
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
+#ifdef KUSERMAP
+  // A kernel page table in which copyin() and copyout()
+  // can reach the user page table's pages directly.
+  if((p->kpagetable = kvmcreate()) == 0){
     freeproc(p);
-    release(&p->lock);
     return 0;
   }
+#endif
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -127,29 +313,51 @@ found:
   p->context.ra = (uint64)forkret;
   p->context.sp = p->kstack + PGSIZE;
 
+  allocpid(p);
+  acquire(&p->lock);
   return p;
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// including user pages and its kernel stack, and give it
+// back to procslab. p->lock must not be held, and p must
+// not be RUNNABLE or on anyone's list of children.
 static void
 freeproc(struct proc *p)
 {
+  // once out of pidhash[], p can't be found; anyone who
+  // found it before holds p->lock, so wait for them.
+  if(p->pid)
+    freepid(p);
+  acquire(&p->lock);
+  release(&p->lock);
+
+  // exit() has already let go of a process's memory;
+  // only one that never ran still has it.
+  if(p->vm)
+    vmput(p);
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
+#ifdef KUSERMAP
+  if(p->kpagetable)
+    kvmfree(p->kpagetable);
+  p->kpagetable = 0;
+#endif
+  p->tfva = 0;
+  p->thread = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->nice = 0;
+  p->vruntime = 0;
+  p->runtime = 0;
+  kstackfree(p);
   p->state = UNUSED;
+  slabfree(&procslab, p);
 }
 
 // Create a user page table for a given process,
@@ -185,13 +393,222 @@ proc_pagetable(struct proc *p)
   return pagetable;
 }
 
+// Give p a new address space, with no user memory yet,
+// and p's trapframe in the first TRAPFRAMES() slot.
+// Returns 0, or -1 if memory is exhausted.
+static int
+vmcreate(struct proc *p)
+{
+  struct vmspace *vm;
+
+  if((vm = slaballoc(&vmslab)) == 0)
+    return -1;
+  if((vm->pagetable = proc_pagetable(p)) == 0){
+    slabfree(&vmslab, vm);
+    return -1;
+  }
+  vm->ref = 1;
+  vm->sz = 0;
+  vm->tfmap = 1;
+  memset(vm->vma, 0, sizeof(vm->vma));
+  p->vm = vm;
+  p->pagetable = vm->pagetable;
+  p->tfva = TRAPFRAME;
+  return 0;
+}
+
+// Let go of p's address space. Other threads keep it, less
+// p's trapframe; the last one frees it, first writing back
+// and closing its areas, which may sleep unless there are
+// none, as for a process that never ran.
+static void
+vmput(struct proc *p)
+{
+  struct vmspace *vm = p->vm;
+
+  acquire(&vm->lock);
+  if(vm->ref > 1){
+    vm->ref--;
+    uvmunmap(vm->pagetable, p->tfva, 1, 0);
+    vm->tfmap &= ~(1 << ((TRAPFRAME - p->tfva) / PGSIZE));
+    release(&vm->lock);
+  } else {
+    // no other thread is left that could clone() a new one.
+    release(&vm->lock);
+    vmaclose(vm->vma, vm->pagetable);
+    proc_freepagetable(vm->pagetable, p->tfva, vm->sz);
+    vm->pagetable = 0;
+    vm->sz = 0;
+    vm->ref = 0;
+    slabfree(&vmslab, vm);
+  }
+  p->vm = 0;
+  p->pagetable = 0;
+}
+
+// Make sure no other CPU still uses a PTE of vm that has
+// just been changed: each that is running one of vm's threads
+// in user space is interrupted, since entering the kernel
+// flushes its TLB, and waited for. Caller must hold vm->lock.
+void
+tlbshootdown(struct vmspace *vm)
+{
+  struct cpu *c, *me;
+  struct proc *p;
+  uint ntrap[NCPU];
+  int want[NCPU], i;
+
+  push_off();
+  me = mycpu();
+  __sync_synchronize();
+  for(i = 0; i < NCPU; i++){
+    c = &cpus[i];
+    ntrap[i] = c->ntrap;
+    p = c->proc;
+    want[i] = c != me && c->inuser && p && p->vm == vm;
+    if(want[i])
+      clockkick(i);
+  }
+  for(i = 0; i < NCPU; i++){
+    c = &cpus[i];
+    while(want[i] && c->inuser && c->ntrap == ntrap[i])
+      __sync_synchronize();
+  }
+  pop_off();
+}
+
+// Give np a copy of p's open files and current directory.
+// Returns 0, or -1 if memory is exhausted.
+static int
+filesdup(struct proc *np, struct proc *p)
+{
+  struct files *f, *pf = p->files;
+  struct file **ofile;
+  int fd;
+
+  if((f = slaballoc(&filesslab)) == 0)
+    return -1;
+  ofile = f->ofile0;
+  acquire(&pf->lock);
+  // a grown table stays grown, since its high descriptors
+  // may be in use. another thread may grow it meanwhile.
+  while(pf->nofile > NOFILE && ofile == f->ofile0){
+    release(&pf->lock);
+    if((ofile = kzalloc()) == 0){
+      slabfree(&filesslab, f);
+      return -1;
+    }
+    acquire(&pf->lock);
+  }
+  f->ref = 1;
+  f->ofile = ofile;
+  f->nofile = pf->nofile;
+  for(fd = 0; fd < pf->nofile; fd++)
+    f->ofile[fd] = pf->ofile[fd] ? filedup(pf->ofile[fd]) : 0;
+  f->cwd = idup(pf->cwd);
+  release(&pf->lock);
+  np->files = f;
+  return 0;
+}
+
+// Give np p's current directory, and as its descriptors
+// 0..NSPAWNFD-1 p's descriptors fds[0..NSPAWNFD-1], or none
+// where fds[i] is -1. Returns 0, or -1 if one of fds is not
+// open or memory is exhausted.
+static int
+filespick(struct proc *np, struct proc *p, int *fds)
+{
+  struct files *f, *pf = p->files;
+  int i;
+
+  if((f = slaballoc(&filesslab)) == 0)
+    return -1;
+  f->ref = 1;
+  f->ofile = f->ofile0;
+  f->nofile = NOFILE;
+  memset(f->ofile0, 0, sizeof(f->ofile0));
+  acquire(&pf->lock);
+  for(i = 0; i < NSPAWNFD; i++){
+    if(fds[i] == -1)
+      continue;
+    if(fds[i] < 0 || fds[i] >= pf->nofile || pf->ofile[fds[i]] == 0)
+      break;
+    f->ofile[i] = filedup(pf->ofile[fds[i]]);
+  }
+  f->cwd = idup(pf->cwd);
+  release(&pf->lock);
+  np->files = f;
+  if(i < NSPAWNFD){
+    filesput(np);
+    return -1;
+  }
+  return 0;
+}
+
+// Let go of p's open files and current directory. The
+// last thread using them closes them.
+static void
+filesput(struct proc *p)
+{
+  struct files *f = p->files;
+  struct inode *cwd;
+  int fd;
+
+  acquire(&f->lock);
+  if(f->ref > 1){
+    f->ref--;
+    release(&f->lock);
+    p->files = 0;
+    return;
+  }
+  release(&f->lock);
+
+  for(fd = 0; fd < f->nofile; fd++){
+    if(f->ofile[fd]){
+      fileclose(f->ofile[fd]);
+      f->ofile[fd] = 0;
+    }
+  }
+  if(f->ofile != f->ofile0)
+    kfree(f->ofile);
+  cwd = f->cwd;
+  f->cwd = 0;
+  begin_op();
+  iput(cwd);
+  end_op();
+
+  f->ref = 0;
+  slabfree(&filesslab, f);
+  p->files = 0;
+}
+
+// Make room for more descriptors in f, when all of
+// f->ofile is in use. Caller must hold f->lock.
+// Returns 0, or -1 if f is as big as it gets or memory
+// is exhausted.
+int
+filesgrow(struct files *f)
+{
+  struct file **ofile;
+
+  if(f->nofile >= MAXOFILE || (ofile = kzalloc()) == 0)
+    return -1;
+  memmove(ofile, f->ofile, f->nofile * sizeof(struct file*));
+  if(f->ofile != f->ofile0)
+    kfree(f->ofile);
+  f->ofile = ofile;
+  f->nofile = MAXOFILE;
+  return 0;
+}
+
 // Free a process's page table, and free the
-// physical memory it refers to.
+// physical memory it refers to. tfva is where the last
+// thread's trapframe is mapped.
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz)
+proc_freepagetable(pagetable_t pagetable, uint64 tfva, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, tfva, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -215,42 +632,77 @@ userinit(void)
 
   p = allocproc();
   initproc = p;
+  if(vmcreate(p) < 0)
+    panic("userinit");
   
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  p->vm->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
   p->trapframe->sp = PGSIZE;  // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  if((p->files = slaballoc(&filesslab)) == 0)
+    panic("userinit");
+  p->files->ref = 1;
+  p->files->ofile = p->files->ofile0;
+  p->files->nofile = NOFILE;
+  memset(p->files->ofile0, 0, sizeof(p->files->ofile0));
+  p->files->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Growing only moves vm->sz: uvmfault() allocates each
+// page when it is first touched. Shrinking unmaps and
+// frees whatever pages were actually allocated.
+// Return the old size, or -1 on failure.
+uint64
 growproc(int n)
 {
-  uint sz;
+  uint64 sz, oldsz;
   struct proc *p = myproc();
+  struct vmspace *vm = p->vm;
 
-  sz = p->sz;
+  acquiresleep(&vm->maplock);
+  acquire(&vm->lock);
+  sz = oldsz = vm->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
-      return -1;
-    }
+    if(sz + n > vmabase(p))
+      goto bad;
+    sz += n;
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if(-n > sz)
+      goto bad;
+    // split a superpage the new end cuts through before
+    // anything is taken away, so that running out of memory
+    // leaves the process as it was.
+    if(uvmsplit(vm->pagetable, PGROUNDUP(sz + n), PGROUNDUP(sz)) < 0)
+      goto bad;
+    if(vm->ref > 1){
+      // other threads must stop using the pages first.
+      if(uvmrevoke(vm->pagetable, PGROUNDUP(sz + n),
+                   (PGROUNDUP(sz) - PGROUNDUP(sz + n)) / PGSIZE) < 0)
+        goto bad;
+      tlbshootdown(vm);
+    }
+    sz = uvmdealloc(vm->pagetable, sz, sz + n);
   }
-  p->sz = sz;
-  return 0;
+  vm->sz = sz;
+  release(&vm->lock);
+  releasesleep(&vm->maplock);
+  return oldsz;
+
+ bad:
+  release(&vm->lock);
+  releasesleep(&vm->maplock);
+  return -1;
 }
 
 // Create a new process, copying the parent.
@@ -258,24 +710,42 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct vmspace *vm = p->vm;
+
+  // Map all of any MAP_SHARED areas, so the child shares them.
+  if(vmafill(p) < 0)
+    return -1;
 
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
-
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
-    freeproc(np);
-    release(&np->lock);
-    return -1;
+  if(vmcreate(np) < 0)
+    goto bad;
+
+  // Copy user memory from parent to child. Pages become
+  // copy-on-write, so other threads of the parent must
+  // stop writing them.
+  acquire(&vm->lock);
+  if(uvmcopy(p->pagetable, np->pagetable, vm->sz) < 0){
+    release(&vm->lock);
+    goto bad;
+  }
+  np->vm->sz = vm->sz;
+  if(vmadup(np, p) < 0){
+    release(&vm->lock);
+    goto bad;
   }
-  np->sz = p->sz;
+  if(vm->ref > 1)
+    tlbshootdown(vm);
+  release(&vm->lock);
 
-  np->parent = p;
+  // increment reference counts on open file descriptors.
+  if(filesdup(np, p) < 0)
+    goto bad;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -283,47 +753,177 @@ fork(void)
   // Cause fork to return 0 in the child.
   np->trapframe->a0 = 0;
 
-  // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  // the child starts out level with its parent.
+  np->nice = p->nice;
+  np->cpumask = p->cpumask;
+  np->vruntime = p->vruntime;
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  adopt(p, np, 0);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+
+ bad:
+  // freeing np closes its areas, which may sleep, so not
+  // with np->lock held.
+  release(&np->lock);
+  freeproc(np);
+  return -1;
+}
+
+// Create a thread of the current process, which shares its
+// memory, open files and current directory, and starts in
+// fn(arg) on the user stack whose top is stack. fn must
+// not return; the thread ends by calling exit(). Returns
+// the new thread's pid, for join().
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct vmspace *vm = p->vm;
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  // the thread's trapframe goes in a free slot of the
+  // shared page table.
+  acquire(&vm->lock);
+  for(i = 0; i < NTHREAD; i++)
+    if((vm->tfmap & (1 << i)) == 0)
+      break;
+  if(i == NTHREAD ||
+     mappages(vm->pagetable, TRAPFRAMES(i), PGSIZE,
+              (uint64)np->trapframe, PTE_R | PTE_W) != 0){
+    release(&vm->lock);
+    release(&np->lock);
+    freeproc(np);
+    return -1;
+  }
+  vm->tfmap |= 1 << i;
+  vm->ref++;
+  release(&vm->lock);
+  np->vm = vm;
+  np->pagetable = vm->pagetable;
+  np->tfva = TRAPFRAMES(i);
+
+  acquire(&p->files->lock);
+  p->files->ref++;
+  release(&p->files->lock);
+  np->files = p->files;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
+  np->nice = p->nice;
+  np->cpumask = p->cpumask;
+  np->vruntime = p->vruntime;
 
   pid = np->pid;
+  release(&np->lock);
 
-  np->state = RUNNABLE;
+  adopt(p, np, 1);
 
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+  return pid;
+}
+
+// Start a child running the program path with arguments
+// argv, as fork() and then exec() in the child would, but
+// without copying the caller's memory only to throw it away.
+// The child gets a copy of the caller's open files, or if
+// fds is not 0, only the NSPAWNFD descriptors fds names
+// (see filespick()). Returns the child's pid, or -1 if the
+// program cannot be loaded, with no child made.
+int
+spawn(char *path, char **argv, int *fds)
+{
+  int pid, argc;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+  // loading the program may sleep, so not with np->lock
+  // held; np is not RUNNABLE, so nothing else will touch it.
+  release(&np->lock);
+  if(vmcreate(np) < 0)
+    goto bad;
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = execload(np, path, argv)) < 0)
+    goto bad;
+  np->trapframe->a0 = argc;
+  if((fds ? filespick(np, p, fds) : filesdup(np, p)) < 0)
+    goto bad;
+
+  acquire(&np->lock);
+  np->nice = p->nice;
+  np->cpumask = p->cpumask;
+  np->vruntime = p->vruntime;
+  pid = np->pid;
+  release(&np->lock);
+
+  adopt(p, np, 0);
+
+  acquire(&np->lock);
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
+
+ bad:
+  freeproc(np);
+  return -1;
 }
 
-// Pass p's abandoned children to init.
-// Caller must hold p->lock.
+// Make np a child of p, for wait(), or a thread of p, for
+// join(), if thread is 1.
+static void
+adopt(struct proc *p, struct proc *np, int thread)
+{
+  acquire(&wait_lock);
+  np->parent = p;
+  np->thread = thread;
+  np->sibling = p->children;
+  p->children = np;
+  release(&wait_lock);
+}
+
+// Pass p's abandoned children to init, and wake init
+// if there were any, since some may have exited already.
+// Caller must hold wait_lock.
 void
 reparent(struct proc *p)
 {
-  struct proc *pp;
-
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    // this code uses pp->parent without holding pp->lock.
-    // acquiring the lock first could cause a deadlock
-    // if pp or a child of pp were also in exit()
-    // and about to try to lock p.
-    if(pp->parent == p){
-      // pp->parent can't change between the check and the acquire()
-      // because only the parent changes it, and we're the parent.
-      acquire(&pp->lock);
-      pp->parent = initproc;
-      // we should wake up init here, but that would require
-      // initproc->lock, which would be a deadlock, since we hold
-      // the lock on one of init's children (pp). this is why
-      // exit() always wakes init (before acquiring any locks).
-      release(&pp->lock);
-    }
+  struct proc *pp, *last;
+
+  if(p->children == 0)
+    return;
+  for(pp = p->children; pp; pp = pp->sibling){
+    pp->parent = initproc;
+    // init wait()s for orphaned threads too.
+    pp->thread = 0;
+    last = pp;
   }
+  last->sibling = initproc->children;
+  initproc->children = p->children;
+  p->children = 0;
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -337,55 +937,26 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  // Close all open files, and free user memory, unless
+  // other threads are still using them.
+  filesput(p);
+  vmput(p);
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
-
-  // we might re-parent a child to init. we can't be precise about
-  // waking up init, since we can't acquire its lock once we've
-  // acquired any other proc lock. so wake up init whether that's
-  // necessary or not. init may miss this wakeup, but that seems
-  // harmless.
-  acquire(&initproc->lock);
-  wakeup1(initproc);
-  release(&initproc->lock);
-
-  // grab a copy of p->parent, to ensure that we unlock the same
-  // parent we locked. in case our parent gives us away to init while
-  // we're waiting for the parent lock. we may then race with an
-  // exiting parent, but the result will be a harmless spurious wakeup
-  // to a dead or wrong process; proc structs are never re-allocated
-  // as anything else.
-  acquire(&p->lock);
-  struct proc *original_parent = p->parent;
-  release(&p->lock);
-  
-  // we need the parent's lock in order to wake it up from wait().
-  // the parent-then-child rule says we have to lock it first.
-  acquire(&original_parent->lock);
-
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   // Give any children to init.
   reparent(p);
 
   // Parent might be sleeping in wait().
-  wakeup1(original_parent);
+  wakeup(p->parent);
+
+  acquire(&p->lock);
 
   p->xstate = status;
+  charge(p);
   p->state = ZOMBIE;
 
-  release(&original_parent->lock);
+  release(&wait_lock);
 
   // Jump into the scheduler, never to return.
   sched();
@@ -397,59 +968,342 @@ exit(int status)
 int
 wait(uint64 addr)
 {
-  struct proc *np;
-  int havekids, pid;
+  return reap(0, 0, addr);
+}
+
+// Wait for thread tid, or any thread if tid is 0, that
+// this one clone()d, to exit, and return its pid.
+// Return -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  return reap(1, tid, addr);
+}
+
+// Wait for a child to exit: a thread, if thread is 1, else
+// a process made by fork(). pid 0 matches any. Copy its
+// exit status to addr, if not 0, and return its pid.
+static int
+reap(int thread, int pid, uint64 addr)
+{
+  struct proc *np, **pp;
+  int havekids;
   struct proc *p = myproc();
 
-  // hold p->lock for the whole time to avoid lost
+  // the copyout() below runs with locks held.
+  if(addr != 0 && vmaprefault(p, addr, sizeof(int)) < 0)
+    return -1;
+
+  // hold wait_lock for the whole time to avoid lost
   // wakeups from a child's exit().
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through p's children looking for exited ones.
     havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
-      // this code uses np->parent without holding np->lock.
-      // acquiring the lock first would cause a deadlock,
-      // since np might be an ancestor, and we already hold p->lock.
-      if(np->parent == p){
-        // np->parent can't change between the check and the acquire()
-        // because only the parent changes it, and we're the parent.
-        acquire(&np->lock);
-        havekids = 1;
-        if(np->state == ZOMBIE){
-          // Found one.
-          pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&p->lock);
-            return -1;
-          }
-          freeproc(np);
+    for(pp = &p->children; (np = *pp) != 0; pp = &np->sibling){
+      if(np->thread != thread || (pid != 0 && np->pid != pid))
+        continue;
+      havekids = 1;
+      acquire(&np->lock);
+      if(np->state == ZOMBIE){
+        // Found one.
+        pid = np->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
+                                sizeof(np->xstate)) < 0) {
           release(&np->lock);
-          release(&p->lock);
-          return pid;
+          release(&wait_lock);
+          return -1;
         }
+        *pp = np->sibling;
+        np->sibling = 0;
         release(&np->lock);
+        release(&wait_lock);
+        freeproc(np);
+        return pid;
       }
+      release(&np->lock);
     }
 
     // No point waiting if we don't have any children.
     if(!havekids || p->killed){
-      release(&p->lock);
+      release(&wait_lock);
       return -1;
     }
     
     // Wait for a child to exit.
-    sleep(p, &p->lock);  //DOC: wait-sleep
+    sleep(p, &wait_lock);  //DOC: wait-sleep
+  }
+}
+
+// Each CPU has a queue of RUNNABLE processes. A process is
+// queued on the CPU it last ran on, for the sake of its
+// caches, or a new one on the CPU that forked it. A CPU
+// that runs out of work steals from the busiest other one.
+// Neither puts a process on a CPU outside its p->cpumask,
+// which does not change while the process is queued.
+//
+// A queue is a binary min-heap on p->vruntime, the CPU time
+// p has used, scaled down by its nice weight, so that over
+// time each process gets CPU in proportion to its weight.
+// Putting a process on or taking one off takes O(log n).
+
+// Charge p for the CPU time it has used since it was
+// last charged. Caller must hold p->lock.
+static void
+charge(struct proc *p)
+{
+  uint64 now, d;
+
+  now = clocknow();
+  d = now - p->runstart;
+  p->runtime += d;
+  p->vruntime += d * NICE0WEIGHT / niceweight[p->nice - NICEMIN];
+  p->runstart = now;
+}
+
+// Should a run before b? Equal vruntimes go in the order
+// they were queued.
+static int
+runqless(struct proc *a, struct proc *b)
+{
+  return a->vruntime < b->vruntime ||
+         (a->vruntime == b->vruntime && a->readytime < b->readytime);
+}
+
+// Put p in c->rq[i], then move it up or down until c's heap
+// is in order again. Caller must hold c->rqlock.
+static void
+runqfix(struct cpu *c, struct proc *p, int i)
+{
+  int j;
+
+  while(i > 0 && runqless(p, c->rq[(i-1)/2])){
+    c->rq[i] = c->rq[(i-1)/2];
+    c->rq[i]->rqindex = i;
+    i = (i-1)/2;
+  }
+  for(;;){
+    j = 2*i + 1;
+    if(j >= c->rqlen)
+      break;
+    if(j+1 < c->rqlen && runqless(c->rq[j+1], c->rq[j]))
+      j++;
+    if(!runqless(c->rq[j], p))
+      break;
+    c->rq[i] = c->rq[j];
+    c->rq[i]->rqindex = i;
+    i = j;
   }
+  c->rq[i] = p;
+  p->rqindex = i;
+}
+
+// Take c->rq[i] off c's run queue and return it.
+// Caller must hold c->rqlock.
+static struct proc*
+runqdel(struct cpu *c, int i)
+{
+  struct proc *p;
+
+  p = c->rq[i];
+  p->rqindex = -1;
+  c->rqlen--;
+  if(i < c->rqlen)
+    runqfix(c, c->rq[c->rqlen], i);
+  return p;
+}
+
+// Mark p RUNNABLE and queue it.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct cpu *c, *v;
+
+  if(!holding(&p->lock))
+    panic("setrunnable");
+  p->state = RUNNABLE;
+  p->readytime = r_time();
+  c = p->cpu >= 0 ? &cpus[p->cpu] : mycpu();
+  if((p->cpumask & (1 << (c - cpus))) == 0){
+    // the least busy of the CPUs p may use.
+    c = 0;
+    for(v = cpus; v < &cpus[NCPU]; v++)
+      if((p->cpumask & (1 << (v - cpus))) && (c == 0 || v->rqlen < c->rqlen))
+        c = v;
+  }
+  acquire(&c->rqlock);
+  // a process that slept for a long time gets a head start,
+  // but not so much that it keeps the others out.
+  if(p->vruntime + SLEEPCREDIT < c->minvruntime)
+    p->vruntime = c->minvruntime - SLEEPCREDIT;
+  p->rqcpu = c - cpus;
+  c->rqlen++;
+  runqfix(c, p, c->rqlen - 1);
+  release(&c->rqlock);
+
+  // an idle CPU looks for work only when interrupted: kick
+  // c if it is idle, or else an idle CPU that can steal p,
+  // unless p is just yielding and will be run right away.
+  __sync_synchronize();
+  if(c->idle){
+    clockkick(c - cpus);
+  } else if(p != myproc()){
+    for(v = cpus; v < &cpus[NCPU]; v++){
+      if(v->idle && (p->cpumask & (1 << (v - cpus)))){
+        clockkick(v - cpus);
+        break;
+      }
+    }
+  }
+}
+
+// The place in v's run queue of the process with the least
+// vruntime that may run on c, or -1. That is the front of
+// the heap unless p->cpumask keeps it off c, which is rare
+// enough to search for the rest. Caller must hold v->rqlock.
+static int
+runqfind(struct cpu *v, struct cpu *c)
+{
+  int i, best;
+
+  if(v->rqlen == 0)
+    return -1;
+  if(v->rq[0]->cpumask & (1 << (c - cpus)))
+    return 0;
+  best = -1;
+  for(i = 1; i < v->rqlen; i++)
+    if((v->rq[i]->cpumask & (1 << (c - cpus))) &&
+       (best < 0 || runqless(v->rq[i], v->rq[best])))
+      best = i;
+  return best;
+}
+
+// Take the process with the least vruntime that may run
+// on c off v's run queue, or return 0.
+static struct proc*
+runqget(struct cpu *v, struct cpu *c)
+{
+  struct proc *p;
+  int i;
+
+  p = 0;
+  acquire(&v->rqlock);
+  if((i = runqfind(v, c)) >= 0){
+    p = runqdel(v, i);
+    if(p->vruntime > v->minvruntime)
+      v->minvruntime = p->vruntime;
+  }
+  release(&v->rqlock);
+  return p;
+}
+
+// Is there a process on v's run queue that may run on c?
+static int
+runqhas(struct cpu *v, struct cpu *c)
+{
+  int r;
+
+  acquire(&v->rqlock);
+  r = runqfind(v, c) >= 0;
+  release(&v->rqlock);
+  return r;
+}
+
+// Take p off the run queue it is on. Caller must hold
+// p->lock, which keeps setrunnable() from moving p to
+// another queue. Returns 0 if p is on none, because a
+// scheduler has just taken it off to run it.
+static int
+runqremove(struct proc *p)
+{
+  struct cpu *v;
+  int r;
+
+  v = &cpus[p->rqcpu];
+  acquire(&v->rqlock);
+  r = p->rqindex >= 0;
+  if(r)
+    runqdel(v, p->rqindex);
+  release(&v->rqlock);
+  return r;
+}
+
+// Take a process from the other CPU with the longest
+// run queue, for c, which has none of its own. Skip
+// queues that hold only processes c may not run.
+static struct proc*
+runqsteal(struct cpu *c)
+{
+  struct cpu *v, *busiest;
+  struct proc *p;
+  uint tried;
+
+  tried = 1 << (c - cpus);
+  for(;;){
+    // unlocked reads: only a hint. runqget() finds out for sure.
+    busiest = 0;
+    for(v = cpus; v < &cpus[NCPU]; v++)
+      if((tried & (1 << (v - cpus))) == 0 && v->rqlen > 0 &&
+         (busiest == 0 || v->rqlen > busiest->rqlen))
+        busiest = v;
+    if(busiest == 0)
+      return 0;
+    // p was first in line on busiest, of those c may run;
+    // put it level with the front of c's queue. vruntimes on
+    // different CPUs are not comparable. p is on no queue and
+    // not running, so no one else looks at p->vruntime until
+    // it runs.
+    if((p = runqget(busiest, c)) != 0){
+      p->vruntime = c->minvruntime;
+      return p;
+    }
+    tried |= 1 << (busiest - cpus);
+  }
+}
+
+// Count a time of d mtime cycles in histogram h, in the
+// bucket for its log2 in microseconds.
+static void
+histadd(uint64 *h, uint64 d)
+{
+  int i;
+
+  d /= TIMEBASE / 1000000;
+  for(i = 0; d > 1 && i < NSCHEDHIST-1; i++)
+    d >>= 1;
+  h[i]++;
+}
+
+// Wait for an interrupt, with this CPU's clock ticking
+// only for the next timer deadline.
+static void
+idle(struct cpu *c)
+{
+  struct cpu *v;
+
+  intr_off();
+  c->idle = 1;
+  __sync_synchronize();
+  // look again, now that setrunnable() would kick us.
+  for(v = cpus; v < &cpus[NCPU]; v++)
+    if(v->rqlen > 0 && runqhas(v, c))
+      break;
+  if(v == &cpus[NCPU]){
+    clockidle();
+    asm volatile("wfi");
+    clockbusy();
+  }
+  c->idle = 0;
+  intr_on();
 }
 
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run: the one with the least vruntime
+//    on this CPU's run queue, or one stolen from another CPU.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -458,35 +1312,62 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  uint64 now;
   
   c->proc = 0;
+  __sync_fetch_and_or(&cpuson, 1 << (c - cpus));
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
-    
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-
-        found = 1;
-      }
-      release(&p->lock);
+
+    if((p = runqget(c, c)) == 0)
+      p = runqsteal(c);
+    if(p == 0){
+      // put the idle time to use zeroing pages for kzalloc();
+      // only wait for an interrupt once there is nothing to zero.
+      if(kzero_fill() == 0)
+        idle(c);
+      continue;
     }
-    if(found == 0) {
-      intr_on();
-      asm volatile("wfi");
+
+    // a process that just yielded may still be on its way
+    // out of another CPU; p->lock is held until it is.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    if(p->cpu >= 0 && p->cpu != c - cpus)
+      c->nmigrate++;
+    p->cpu = c - cpus;
+    now = r_time();
+    histadd(c->hwait, now - p->readytime);
+    p->runstart = now;
+    c->proc = p;
+#ifdef KUSERMAP
+    w_satp(MAKE_SATP(p->kpagetable));
+    sfence_vma();
+#else
+    // p's kernel stack may be newer than this CPU's TLB.
+    if(c->kstackgen != kstackgen){
+      c->kstackgen = kstackgen;
+      sfence_vma();
     }
+#endif
+    swtch(&c->context, &p->context);
+#ifdef KUSERMAP
+    kvminithart();
+#endif
+    histadd(c->hslice, c->swtchstart - now);
+    histadd(c->hswtch, r_time() - c->swtchstart);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -513,6 +1394,7 @@ sched(void)
     panic("sched interruptible");
 
   intena = mycpu()->intena;
+  mycpu()->swtchstart = r_time();
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
 }
@@ -523,7 +1405,8 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  charge(p);
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -549,26 +1432,37 @@ forkret(void)
   usertrapret();
 }
 
+static struct sleepq*
+sleepqhash(void *chan)
+{
+  return &sleepq[((uint64)chan >> 3) % NSLEEPQ];
+}
+
 // Atomically release lock and sleep on chan.
-// Reacquires lock when awakened.
+// Reacquires lock when awakened. lk must not be p->lock.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *q;
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once p is on chan's sleep queue, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup holds the queue's lock, then locks p->lock),
   // so it's okay to release lk.
-  if(lk != &p->lock){  //DOC: sleeplock0
-    acquire(&p->lock);  //DOC: sleeplock1
-    release(lk);
-  }
+  q = sleepqhash(chan);
+  acquire(&q->lock);
+  acquire(&p->lock);  //DOC: sleeplock1
+  p->chan = chan;
+  p->sqnext = q->head;
+  q->head = p;
+  release(&q->lock);
+  release(lk);
 
   // Go to sleep.
-  p->chan = chan;
+  charge(p);
   p->state = SLEEPING;
 
   sched();
@@ -577,38 +1471,54 @@ sleep(void *chan, struct spinlock *lk)
   p->chan = 0;
 
   // Reacquire original lock.
-  if(lk != &p->lock){
-    release(&p->lock);
-    acquire(lk);
-  }
+  release(&p->lock);
+  acquire(lk);
 }
 
-// Wake up all processes sleeping on chan.
-// Must be called without any p->lock.
-void
-wakeup(void *chan)
+// Wake up the processes sleeping on chan, or if pid is
+// not 0, only that one. Returns the number woken.
+// A sleeping process can't exit, so while q->lock is held
+// every process on q is still there to be locked; sleep()
+// takes the queue's lock first, too.
+static int
+wake(void *chan, int pid)
 {
-  struct proc *p;
-
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
+  struct sleepq *q = sleepqhash(chan);
+  struct proc *p, **pp;
+  int n;
+
+  n = 0;
+  acquire(&q->lock);
+  for(pp = &q->head; (p = *pp) != 0; ){
+    if(p->chan != chan || (pid != 0 && p->pid != pid)){
+      pp = &p->sqnext;
+      continue;
     }
+    // p is SLEEPING: sleep() holds p->lock until sched()
+    // has switched away from p.
+    acquire(&p->lock);
+    *pp = p->sqnext;
+    p->sqnext = 0;
+    setrunnable(p);
     release(&p->lock);
+    n++;
   }
+  release(&q->lock);
+
+  __sync_fetch_and_add(&sleepstat.nwakeup, 1);
+  if(n == 0)
+    __sync_fetch_and_add(&sleepstat.nwasted, 1);
+  else
+    __sync_fetch_and_add(&sleepstat.nwoken, n);
+  return n;
 }
 
-// Wake up p if it is sleeping in wait(); used by exit().
-// Caller must hold p->lock.
-static void
-wakeup1(struct proc *p)
+// Wake up all processes sleeping on chan.
+// Must be called without any p->lock.
+void
+wakeup(void *chan)
 {
-  if(!holding(&p->lock))
-    panic("wakeup1");
-  if(p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
-  }
+  wake(chan, 0);
 }
 
 // Kill the process with the given pid.
@@ -618,21 +1528,20 @@ int
 kill(int pid)
 {
   struct proc *p;
+  void *chan;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
+  if(pid <= 0 || (p = findproc(pid)) == 0)
+    return -1;
+  for(;;){
+    p->killed = 1;
+    chan = p->state == SLEEPING ? p->chan : 0;
     release(&p->lock);
+    // wake it from sleep(), with p->lock let go, as wakeup()
+    // does; should it wake up meanwhile and sleep again on
+    // something else, try again.
+    if(chan == 0 || wake(chan, pid) > 0 || (p = findproc(pid)) == 0)
+      return 0;
   }
-  return -1;
 }
 
 // Copy to either a user address, or kernel address,
@@ -665,6 +1574,191 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
   }
 }
 
+// Format sleep and wakeup statistics into buf, for the
+// statistics device. Returns the number of bytes used.
+int
+sleepstats(char *buf, int sz)
+{
+  return snprintf(buf, sz, "sleep: wakeups %d wasted %d woken %d\n",
+                  sleepstat.nwakeup, sleepstat.nwasted, sleepstat.nwoken);
+}
+
+// Format per-CPU scheduling statistics into buf, for the
+// statistics device. Returns the number of bytes used.
+int
+schedstats(char *buf, int sz)
+{
+  struct cpu *c;
+  int n;
+
+  n = 0;
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if((cpuson & (1 << (c - cpus))) == 0)
+      continue;
+    n += snprintf(buf+n, sz-n, "cpu %d: migrations %d\n",
+                  (int)(c - cpus), c->nmigrate);
+  }
+  return n;
+}
+
+// Add incr to the current process's nice value, within
+// NICEMIN..NICEMAX, and return the new value.
+int
+nice(int incr)
+{
+  struct proc *p = myproc();
+  int n;
+
+  acquire(&p->lock);
+  // the time so far is charged at the old weight.
+  charge(p);
+  n = p->nice + incr;
+  if(n < NICEMIN)
+    n = NICEMIN;
+  if(n > NICEMAX)
+    n = NICEMAX;
+  p->nice = n;
+  release(&p->lock);
+  return n;
+}
+
+// Let process pid, or the caller if pid is 0, run only on
+// the CPUs in mask, bit i for cpus[i]. Returns 0, or -1 if
+// there is no such process or mask names no running CPU.
+int
+setaffinity(int pid, uint mask)
+{
+  struct proc *p;
+  int move;
+
+  mask &= cpuson;
+  if(mask == 0)
+    return -1;
+  if(pid == 0){
+    p = myproc();
+    acquire(&p->lock);
+  } else if(pid < 0 || (p = findproc(pid)) == 0)
+    return -1;
+  if(p->state == RUNNABLE && runqremove(p)){
+    p->cpumask = mask;
+    setrunnable(p);
+  } else {
+    // a running process moves the next time it is queued;
+    // one a scheduler has just taken off a queue runs once
+    // where it was, then does the same.
+    p->cpumask = mask;
+  }
+  move = p == myproc() && (mask & (1 << p->cpu)) == 0;
+  release(&p->lock);
+  if(move)
+    yield();
+  return 0;
+}
+
+// Return the CPU mask of process pid, or of the caller if
+// pid is 0, or -1 if there is no such process.
+int
+getaffinity(int pid)
+{
+  struct proc *p;
+  int mask;
+
+  if(pid == 0){
+    p = myproc();
+    acquire(&p->lock);
+  } else if(pid < 0 || (p = findproc(pid)) == 0)
+    return -1;
+  mask = p->cpumask & cpuson;
+  release(&p->lock);
+  return mask;
+}
+
+// Copy a struct schedstat for each of up to n running CPUs
+// to user address addr. Returns the number copied, or -1.
+int
+schedstat(uint64 addr, int n)
+{
+  struct schedstat st;
+  struct cpu *c;
+  int i;
+
+  i = 0;
+  for(c = cpus; c < &cpus[NCPU] && i < n; c++){
+    if((cpuson & (1 << (c - cpus))) == 0)
+      continue;
+    // unlocked reads of c's counters: a snapshot, not exact.
+    st.cpu = c - cpus;
+    st.nmigrate = c->nmigrate;
+    memmove(st.wait, c->hwait, sizeof(st.wait));
+    memmove(st.slice, c->hslice, sizeof(st.slice));
+    memmove(st.swtch, c->hswtch, sizeof(st.swtch));
+    if(copyout(myproc()->pagetable, addr + i*sizeof(st), (char *)&st, sizeof(st)) < 0)
+      return -1;
+    i++;
+  }
+  return i;
+}
+
+// Copy a struct procinfo for each of up to n processes to
+// user address addr. Returns the number copied, or -1.
+int
+getprocs(uint64 addr, int n)
+{
+  static char states[] = {
+  [SLEEPING]  'S',
+  [RUNNABLE]  'W',
+  [RUNNING]   'R',
+  [ZOMBIE]    'Z'
+  };
+  struct proc *p;
+  struct procinfo pi;
+  uint64 t;
+  int i, h, last;
+
+  // a chain of pidhash[] has the newest process first, so is
+  // in falling pid order; pid_lock is let go before each
+  // copyout(), and the walk picks up after the last pid seen.
+  i = 0;
+  for(h = 0; h < NPIDHASH && i < n; h++){
+    last = 0;
+    while(i < n){
+      acquire(&pid_lock);
+      for(p = pidhash[h]; p && last && p->pid >= last; p = p->pidnext)
+        ;
+      if(p == 0){
+        release(&pid_lock);
+        break;
+      }
+      last = p->pid;
+      acquire(&p->lock);
+      if(p->state == UNUSED){
+        release(&p->lock);
+        release(&pid_lock);
+        continue;
+      }
+      pi.pid = p->pid;
+      // the parent can't be freed while pid_lock is held.
+      pi.ppid = p->parent ? p->parent->pid : 0;
+      pi.state = states[p->state];
+      pi.cpu = p->cpu;
+      pi.nice = p->nice;
+      pi.sz = p->vm ? p->vm->sz : 0;
+      t = p->runtime;
+      if(p->state == RUNNING)
+        t += clocknow() - p->runstart;
+      pi.cputime = t / (TIMEBASE / 1000000);
+      safestrcpy(pi.name, p->name, sizeof(pi.name));
+      release(&p->lock);
+      release(&pid_lock);
+
+      if(copyout(myproc()->pagetable, addr + i*sizeof(pi), (char *)&pi, sizeof(pi)) < 0)
+        return -1;
+      i++;
+    }
+  }
+  return i;
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
@@ -680,16 +1774,20 @@ procdump(void)
   };
   struct proc *p;
   char *state;
+  int h;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
-    if(p->state == UNUSED)
-      continue;
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
-    else
-      state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
-    printf("\n");
+  for(h = 0; h < NPIDHASH; h++){
+    for(p = pidhash[h]; p; p = p->pidnext){
+      if(p->state == UNUSED)
+        continue;
+      if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
+        state = states[p->state];
+      else
+        state = "???";
+      printf("%d %s %s nice %d cpu %dms", p->pid, state, p->name,
+             p->nice, (int)(p->runtime / (TIMEBASE / 1000)));
+      printf("\n");
+    }
   }
 }
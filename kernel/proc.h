@@ -24,6 +24,24 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int idle;                   // In wfi with its clock stopped?
+  int inuser;                 // Running c->proc in user space?
+  uint ntrap;                 // Traps from user space, for tlbshootdown()
+  uint kstackgen;             // kernel stacks this CPU's TLB knows about
+  uint nmigrate;              // processes run here that last ran elsewhere
+
+  // scheduling histograms; see schedstat.h.
+  uint64 hwait[NSCHEDHIST];
+  uint64 hslice[NSCHEDHIST];
+  uint64 hswtch[NSCHEDHIST];
+  uint64 swtchstart;          // r_time() at the last sched() here
+
+  // RUNNABLE processes waiting for this cpu: a binary
+  // min-heap on p->vruntime, least in rq[0].
+  struct spinlock rqlock;     // protects rq, rqlen, minvruntime and p->rqindex
+  struct proc *rq[NPROC];
+  int rqlen;
+  uint64 minvruntime;         // largest vruntime yet taken off the queue
 };
 
 extern struct cpu cpus[NCPU];
@@ -80,6 +98,17 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A process's open files and current directory, which
+// its threads share.
+struct files {
+  struct spinlock lock;        // protects ref, ofile, nofile and cwd
+  int ref;                     // Threads using it
+  struct file **ofile;         // Open files: ofile0, or a page once it fills
+  int nofile;                  // Descriptors ofile has room for
+  struct file *ofile0[NOFILE];
+  struct inode *cwd;           // Current directory
+};
+
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -88,19 +117,39 @@ struct proc {
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
-  struct proc *parent;         // Parent process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU it last ran on, or -1 if new
+  int nice;                    // Scheduling priority, NICEMIN..NICEMAX
+  uint cpumask;                // CPUs it may run on, bit i for cpus[i]
+  uint64 vruntime;             // CPU time weighted by nice; least runs first
+  uint64 runtime;              // CPU time used, in mtime cycles
+  uint64 runstart;             // mtime when last charged for CPU time
+  uint64 readytime;            // mtime when last made RUNNABLE
+
+  // wait_lock must be held when using these:
+  struct proc *parent;         // Parent process
+  struct proc *children;       // First child
+  struct proc *sibling;        // Next child of the same parent
+  int thread;                  // Made by clone(), for join() rather than wait()
+
+  int rqcpu;                   // CPU whose run queue p was last put on
+  int rqindex;                 // Place in that queue's rq[], or -1 if off it
+  struct proc *sqnext;         // Next on a sleep queue
+  struct proc *pidnext;        // Next in a pid hash chain; see pid_lock
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  struct vmspace *vm;          // User memory, shared with other threads
+  pagetable_t pagetable;       // User page table; the same as vm->pagetable
+#ifdef KUSERMAP
+  pagetable_t kpagetable;      // Kernel page table, mapping user memory too
+#endif
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // Where trapframe is in the user page table
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct files *files;         // Open files and current directory, shared
   char name[16];               // Process name (debugging)
 };
@@ -0,0 +1,11 @@
+// A process, as getprocs() describes it to user space.
+struct procinfo {
+  int pid;
+  int ppid;        // parent's pid, or 0
+  char state;      // R running, W waiting to run, S sleeping, Z zombie
+  int cpu;         // CPU it is running on, or last ran on; -1 if none yet
+  int nice;
+  uint64 sz;       // bytes of user memory
+  uint64 cputime;  // CPU time used, in microseconds
+  char name[16];
+};
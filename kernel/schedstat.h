@@ -0,0 +1,11 @@
+// One CPU's scheduling histograms, as schedstat() hands
+// them to user space. Bucket i counts times from 2^i up to
+// 2^(i+1) microseconds; bucket 0 counts shorter ones too,
+// and the last bucket longer ones.
+struct schedstat {
+  int cpu;
+  uint nmigrate;                 // processes run here that last ran elsewhere
+  uint64 wait[NSCHEDHIST];       // from RUNNABLE until running
+  uint64 slice[NSCHEDHIST];      // from running until giving up the CPU
+  uint64 swtch[NSCHEDHIST];      // from sched() until back in scheduler()
+};
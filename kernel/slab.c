@@ -0,0 +1,177 @@
+//
+// Object caches, for kernel tables that grow with the load,
+// such as the processes, open files and in-memory inodes.
+// Objects of one size are carved out of whole pages from
+// kalloc(), each page starting with a header that keeps its
+// own list of free objects, linked through a word past the
+// end of each. Pages with free objects are on their slab's
+// partial list; once none of a page's objects is in use, the
+// page goes back to kalloc().
+//
+// So memory that holds an object of some kind holds objects
+// of that kind only as long as its page holds a live one:
+// code must not keep a pointer to an object it has no
+// reference to and may have been freed. ctor runs once per
+// object, when its page is carved up, rather than on each
+// slaballoc(), so locks and the like stay set up across reuse
+// within a page.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "slab.h"
+#include "defs.h"
+
+// at the start of each page of a slab.
+struct slabpage {
+  struct slabpage *next;   // on the slab's partial list,
+  struct slabpage *prev;   //   while free is not 0
+  void *free;              // free objects on this page
+  int nalloc;              // objects in use on this page
+};
+
+// the free-list link of object o of slab s.
+#define NEXT(s, o) (*(void**)((char*)(o) + (s)->size - sizeof(void*)))
+
+// bytes of each page before its first object.
+#define HDRSZ ((sizeof(struct slabpage) + 15) & ~15)
+
+static struct slab *slabs;
+
+// Set up s for objects of size bytes. Called while
+// booting, on one CPU.
+void
+slabinit(struct slab *s, char *name, uint size, void (*ctor)(void*))
+{
+  s->size = (size + sizeof(void*) + 15) & ~15;
+  if(HDRSZ + s->size > PGSIZE)
+    panic("slabinit");
+  initlock(&s->lock, name);
+  s->name = name;
+  s->ctor = ctor;
+  s->partial = 0;
+  s->npage = 0;
+  s->nalloc = 0;
+  s->next = slabs;
+  slabs = s;
+}
+
+// put pg on s's partial list. caller holds s->lock.
+static void
+partialadd(struct slab *s, struct slabpage *pg)
+{
+  pg->prev = 0;
+  pg->next = s->partial;
+  if(pg->next)
+    pg->next->prev = pg;
+  s->partial = pg;
+}
+
+// take pg off s's partial list. caller holds s->lock.
+static void
+partialremove(struct slab *s, struct slabpage *pg)
+{
+  if(pg->prev)
+    pg->prev->next = pg->next;
+  else
+    s->partial = pg->next;
+  if(pg->next)
+    pg->next->prev = pg->prev;
+  pg->next = pg->prev = 0;
+}
+
+// Carve a new page into objects for s. Called without
+// s->lock, since ctor may take other locks.
+// Returns 0, or -1 if out of memory.
+static int
+slabgrow(struct slab *s)
+{
+  struct slabpage *pg;
+  char *o, *last;
+
+  if((pg = kzalloc()) == 0)
+    return -1;
+  last = 0;
+  for(o = (char*)pg + HDRSZ; o + s->size <= (char*)pg + PGSIZE; o += s->size){
+    if(s->ctor)
+      s->ctor(o);
+    if(last)
+      NEXT(s, last) = o;
+    else
+      pg->free = o;
+    last = o;
+  }
+  NEXT(s, last) = 0;
+  acquire(&s->lock);
+  partialadd(s, pg);
+  s->npage++;
+  release(&s->lock);
+  return 0;
+}
+
+// Allocate an object from s. It holds whatever it held when
+// it was last freed, or what ctor set up.
+// Returns 0 if out of memory.
+void*
+slaballoc(struct slab *s)
+{
+  struct slabpage *pg;
+  void *o;
+
+  acquire(&s->lock);
+  while((pg = s->partial) == 0){
+    release(&s->lock);
+    if(slabgrow(s) < 0)
+      return 0;
+    acquire(&s->lock);
+  }
+  o = pg->free;
+  pg->free = NEXT(s, o);
+  if(pg->free == 0)
+    partialremove(s, pg);
+  pg->nalloc++;
+  s->nalloc++;
+  release(&s->lock);
+  return o;
+}
+
+// Give o back to s, and its page back to kalloc() if no
+// other object on it is in use.
+void
+slabfree(struct slab *s, void *o)
+{
+  struct slabpage *pg = (struct slabpage*)PGROUNDDOWN((uint64)o);
+
+  acquire(&s->lock);
+  if(pg->free == 0)
+    partialadd(s, pg);
+  NEXT(s, o) = pg->free;
+  pg->free = o;
+  s->nalloc--;
+  if(--pg->nalloc == 0){
+    partialremove(s, pg);
+    s->npage--;
+  } else {
+    pg = 0;
+  }
+  release(&s->lock);
+  if(pg)
+    kfree(pg);
+}
+
+// Format slab usage into buf, for the statistics device.
+// Returns the number of bytes used.
+int
+slabstats(char *buf, int sz)
+{
+  struct slab *s;
+  int n;
+
+  n = 0;
+  for(s = slabs; s; s = s->next)
+    n += snprintf(buf+n, sz-n, "slab: %s: size %d in use %d pages %d\n",
+                  s->name, s->size, s->nalloc, s->npage);
+  return n;
+}
@@ -0,0 +1,14 @@
+// A cache of fixed-size kernel objects. See slab.c.
+// A free object is linked to the next through a word past
+// its end, not its first word, so its fields stay as they
+// were when it was freed.
+struct slab {
+  struct spinlock lock;
+  char *name;
+  uint size;               // bytes per object, rounded up, and the link
+  void (*ctor)(void*);     // sets up each object once, or 0
+  struct slabpage *partial; // pages with free objects
+  int npage;               // pages taken from kalloc()
+  int nalloc;              // objects in use
+  struct slab *next;       // in the list of all slabs, for slabstats()
+};
@@ -5,5 +5,7 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+  uint n;            // Number of times acquired.
+  uint nts;          // Number of failed test-and-set spins.
 };
 
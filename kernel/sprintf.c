@@ -0,0 +1,121 @@
+//
+// formatted output into a kernel buffer -- snprintf.
+// understands the same %d, %x, %p, %s as printf.
+//
+
+#include <stdarg.h>
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+static char digits[] = "0123456789abcdef";
+
+static int
+sputc(char *s, char c)
+{
+  *s = c;
+  return 1;
+}
+
+static int
+sprintint(char *s, int xx, int base, int sign)
+{
+  char buf[16];
+  int i, n;
+  uint x;
+
+  if(sign && (sign = xx < 0))
+    x = -xx;
+  else
+    x = xx;
+
+  i = 0;
+  do {
+    buf[i++] = digits[x % base];
+  } while((x /= base) != 0);
+
+  if(sign)
+    buf[i++] = '-';
+
+  n = 0;
+  while(--i >= 0)
+    n += sputc(s+n, buf[i]);
+  return n;
+}
+
+static int
+sprintptr(char *s, uint64 x)
+{
+  int i, n;
+
+  n = sputc(s, '0');
+  n += sputc(s+n, 'x');
+  for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
+    n += sputc(s+n, digits[x >> (sizeof(uint64) * 8 - 4)]);
+  return n;
+}
+
+// Print into buf, at most sz-1 characters plus a terminating nul.
+// Returns the number of characters written, not counting the nul.
+int
+snprintf(char *buf, int sz, char *fmt, ...)
+{
+  va_list ap;
+  int i, c;
+  int off = 0;
+  char *s;
+  char tmp[24];
+
+  if (fmt == 0)
+    panic("null fmt");
+  if (sz <= 0)
+    return 0;
+
+  va_start(ap, fmt);
+  for(i = 0; off < sz-1 && (c = fmt[i] & 0xff) != 0; i++){
+    if(c != '%'){
+      off += sputc(buf+off, c);
+      continue;
+    }
+    c = fmt[++i] & 0xff;
+    if(c == 0)
+      break;
+    s = tmp;
+    switch(c){
+    case 'd':
+      tmp[sprintint(tmp, va_arg(ap, int), 10, 1)] = 0;
+      break;
+    case 'x':
+      tmp[sprintint(tmp, va_arg(ap, int), 16, 1)] = 0;
+      break;
+    case 'p':
+      tmp[sprintptr(tmp, va_arg(ap, uint64))] = 0;
+      break;
+    case 's':
+      if((s = va_arg(ap, char*)) == 0)
+        s = "(null)";
+      break;
+    case '%':
+      tmp[0] = '%';
+      tmp[1] = 0;
+      break;
+    default:
+      // Print unknown % sequence to draw attention.
+      tmp[0] = '%';
+      tmp[1] = c;
+      tmp[2] = 0;
+      break;
+    }
+    for(; *s && off < sz-1; s++)
+      off += sputc(buf+off, *s);
+  }
+  va_end(ap);
+  buf[off] = 0;
+  return off;
+}
@@ -0,0 +1,74 @@
+//
+// the statistics device: reading it returns a text dump
+// of kernel counters. the dump is formatted on the first
+// read and handed out in pieces until the reader sees EOF,
+// so a user program can just read until read() returns 0.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define STATSBUFSZ 8192
+
+static struct {
+  struct sleeplock lock;
+  char buf[STATSBUFSZ];
+  int sz;
+  int off;
+} stats;
+
+static int
+statswrite(int user_src, uint64 src, int n)
+{
+  return -1;
+}
+
+static int
+statsread(int user_dst, uint64 dst, int n)
+{
+  int m;
+
+  acquiresleep(&stats.lock);
+
+  if(stats.sz == 0) {
+    stats.sz += kallocstats(stats.buf+stats.sz, STATSBUFSZ-stats.sz);
+    stats.sz += slabstats(stats.buf+stats.sz, STATSBUFSZ-stats.sz);
+    stats.sz += bcachestats(stats.buf+stats.sz, STATSBUFSZ-stats.sz);
+    stats.sz += textstats(stats.buf+stats.sz, STATSBUFSZ-stats.sz);
+    stats.sz += vmstats(stats.buf+stats.sz, STATSBUFSZ-stats.sz);
+    stats.sz += sleepstats(stats.buf+stats.sz, STATSBUFSZ-stats.sz);
+    stats.sz += schedstats(stats.buf+stats.sz, STATSBUFSZ-stats.sz);
+  }
+  m = stats.sz - stats.off;
+
+  if (m > 0) {
+    if(m > n)
+      m = n;
+    if(either_copyout(user_dst, dst, stats.buf+stats.off, m) == -1)
+      m = -1;
+    else
+      stats.off += m;
+  } else {
+    // end of this dump; the next read starts a fresh one.
+    m = 0;
+    stats.sz = 0;
+    stats.off = 0;
+  }
+  releasesleep(&stats.lock);
+  return m;
+}
+
+void
+statsinit(void)
+{
+  initsleeplock(&stats.lock, "stats");
+
+  devsw[STATS].read = statsread;
+  devsw[STATS].write = statswrite;
+}
@@ -1,13 +1,40 @@
 #include "types.h"
+#include "riscv.h"
+
+// memset(), memcmp() and memmove() work a 64-bit word at a
+// time once their pointers are word-aligned, which for two
+// pointers needs them to be equally misaligned to begin with.
+// The bytes before the first word boundary and after the last
+// whole word go one at a time.
+
+#define WORDALIGNED(p) (((uint64)(p) & 7) == 0)
 
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w, *wdst;
+
+  while(n > 0 && !WORDALIGNED(cdst)){
+    *cdst++ = c;
+    n--;
+  }
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+  wdst = (uint64 *) cdst;
+  for(; n >= 32; n -= 32, wdst += 4){
+    wdst[0] = w;
+    wdst[1] = w;
+    wdst[2] = w;
+    wdst[3] = w;
   }
+  for(; n >= 8; n -= 8)
+    *wdst++ = w;
+  cdst = (char *) wdst;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +45,15 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if(WORDALIGNED((uint64)s1 ^ (uint64)s2)){
+    for(; n > 0 && !WORDALIGNED(s1); n--, s1++, s2++)
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    // skip equal words; the bytes of a differing
+    // one are compared below.
+    while(n >= 8 && *(uint64*)s1 == *(uint64*)s2)
+      s1 += 8, s2 += 8, n -= 8;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -36,17 +72,79 @@ memmove(void *dst, const void *src, uint n)
   s = src;
   d = dst;
   if(s < d && s + n > d){
+    // dst overlaps the end of src: copy backwards.
     s += n;
     d += n;
+    if(WORDALIGNED((uint64)s ^ (uint64)d)){
+      for(; n > 0 && !WORDALIGNED(d); n--)
+        *--d = *--s;
+      for(; n >= 8; n -= 8){
+        d -= 8;
+        s -= 8;
+        *(uint64*)d = *(uint64*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(WORDALIGNED((uint64)s ^ (uint64)d)){
+      for(; n > 0 && !WORDALIGNED(d); n--)
+        *d++ = *s++;
+      for(; n >= 32; n -= 32, d += 32, s += 32){
+        ((uint64*)d)[0] = ((uint64*)s)[0];
+        ((uint64*)d)[1] = ((uint64*)s)[1];
+        ((uint64*)d)[2] = ((uint64*)s)[2];
+        ((uint64*)d)[3] = ((uint64*)s)[3];
+      }
+      for(; n >= 8; n -= 8, d += 8, s += 8)
+        *(uint64*)d = *(uint64*)s;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
 
+// Zero the page at pa, which must be page-aligned.
+void
+pagezero(void *pa)
+{
+  uint64 *p, *end;
+
+  end = (uint64*)pa + PGSIZE/8;
+  for(p = pa; p < end; p += 8){
+    p[0] = 0;
+    p[1] = 0;
+    p[2] = 0;
+    p[3] = 0;
+    p[4] = 0;
+    p[5] = 0;
+    p[6] = 0;
+    p[7] = 0;
+  }
+}
+
+// Copy page src to page dst. Both must be page-aligned.
+void
+pagecopy(void *dst, const void *src)
+{
+  uint64 *d, *end;
+  const uint64 *s;
+
+  end = (uint64*)dst + PGSIZE/8;
+  for(d = dst, s = src; d < end; d += 8, s += 8){
+    d[0] = s[0];
+    d[1] = s[1];
+    d[2] = s[2];
+    d[3] = s[3];
+    d[4] = s[4];
+    d[5] = s[5];
+    d[6] = s[6];
+    d[7] = s[7];
+  }
+}
+
 // memcpy exists to placate GCC.  Use memmove.
 void*
 memcpy(void *dst, const void *src, uint n)
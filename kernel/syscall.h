@@ -20,3 +20,14 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_mmap   22
+#define SYS_munmap 23
+#define SYS_nice   24
+#define SYS_getprocs 25
+#define SYS_clone  26
+#define SYS_join   27
+#define SYS_futex  28
+#define SYS_setaffinity 29
+#define SYS_getaffinity 30
+#define SYS_spawn  31
+#define SYS_schedstat 32
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "timer.h"
 
 uint64
 sys_exit(void)
@@ -41,15 +42,11 @@ sys_wait(void)
 uint64
 sys_sbrk(void)
 {
-  int addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  return growproc(n);
 }
 
 uint64
@@ -57,18 +54,24 @@ sys_sleep(void)
 {
   int n;
   uint ticks0;
+  struct timer t;
 
   if(argint(0, &n) < 0)
     return -1;
+  t.pending = 0;
   acquire(&tickslock);
   ticks0 = ticks;
+  if(n > 0)
+    timerstart(&t, n, wakeup, &t);
   while(ticks - ticks0 < n){
     if(myproc()->killed){
+      timerstop(&t);
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    sleep(&t, &tickslock);
   }
+  timerstop(&t);
   release(&tickslock);
   return 0;
 }
@@ -95,3 +98,96 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+uint64
+sys_nice(void)
+{
+  int incr;
+
+  if(argint(0, &incr) < 0)
+    return -1;
+  return nice(incr);
+}
+
+// fill in a struct procinfo for each of up to n processes.
+uint64
+sys_getprocs(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return getprocs(addr, n);
+}
+
+// run process pid (0 for the caller) only on the CPUs in
+// a mask, bit i for CPU i.
+uint64
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return setaffinity(pid, mask);
+}
+
+uint64
+sys_getaffinity(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return getaffinity(pid);
+}
+
+// fill in a struct schedstat for each of up to n CPUs.
+uint64
+sys_schedstat(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return schedstat(addr, n);
+}
+
+// start a thread sharing the caller's memory and files,
+// running fn(arg) on the given stack.
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+// wait for thread tid, or any thread if tid is 0, to exit.
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 addr;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &addr) < 0)
+    return -1;
+  return join(tid, addr);
+}
+
+// FUTEX_WAIT until woken if the int at addr is val, or
+// FUTEX_WAKE up to val waiters on it.
+uint64
+sys_futex(void)
+{
+  uint64 addr;
+  int op, val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  return futex(addr, op, val);
+}
@@ -0,0 +1,234 @@
+//
+// The text page cache: physical pages of read-only program
+// text, shared by every process running the same binary.
+// A page is named by the inode it was read from and its
+// offset in that file.
+//
+// The cache holds one reference to each of its pages and
+// every user mapping holds another, so a page with only one
+// reference is not in use and can be given back when memory
+// runs out (see kalloc()). When a file is written or
+// truncated its pages are dropped from the cache; processes
+// that already map them keep the old contents.
+//
+// Callers hold the inode's sleep-lock, which keeps a page
+// from being looked up, added and invalidated all at once.
+// All pages of one file hash to the same bucket, so that
+// textinval() only has to search one chain.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define NTEXT 256
+#define NTEXTBUCKET 31
+
+struct textpage {
+  uint dev;
+  uint inum;
+  uint off;                // file offset of the page
+  uint n;                  // bytes from the file; the rest is zero
+  char *pa;
+  struct textpage *next;   // in bucket, or in free list
+};
+
+static struct {
+  struct spinlock lock;
+  struct textpage page[NTEXT];
+  struct textpage *bucket[NTEXTBUCKET];
+  struct textpage *freelist;
+  int ncached;
+  int nhit;
+  int nmiss;
+  int nreclaim;
+  int ninval;
+} text;
+
+static void textrelease(struct textpage*);
+
+static struct textpage**
+textbucket(uint dev, uint inum)
+{
+  return &text.bucket[(dev * 7 + inum) % NTEXTBUCKET];
+}
+
+void
+textinit(void)
+{
+  struct textpage *t;
+
+  initlock(&text.lock, "text");
+  for(t = text.page; t < &text.page[NTEXT]; t++){
+    t->next = text.freelist;
+    text.freelist = t;
+  }
+}
+
+// Look for the n bytes at offset off of ip's text.
+// Returns the page with a reference added for the caller,
+// or 0 if it is not in the cache.
+char*
+textget(struct inode *ip, uint off, uint n)
+{
+  struct textpage *t;
+  char *pa;
+
+  acquire(&text.lock);
+  for(t = *textbucket(ip->dev, ip->inum); t; t = t->next){
+    if(t->dev == ip->dev && t->inum == ip->inum && t->off == off && t->n == n){
+      pa = t->pa;
+      kref(pa);
+      text.nhit++;
+      release(&text.lock);
+      return pa;
+    }
+  }
+  text.nmiss++;
+  release(&text.lock);
+  return 0;
+}
+
+// Offer page pa, just read from ip, to the cache.
+// The caller keeps its own reference. If the cache is
+// full, an entry no process maps is recycled; if there is
+// none the page is simply not cached.
+void
+textadd(struct inode *ip, uint off, uint n, char *pa)
+{
+  struct textpage *t, **pp;
+  char *old;
+  int i;
+
+  old = 0;
+  acquire(&text.lock);
+  if((t = text.freelist) != 0){
+    text.freelist = t->next;
+    text.ncached++;
+  } else {
+    for(i = 0; t == 0 && i < NTEXTBUCKET; i++){
+      for(pp = &text.bucket[i]; *pp; pp = &(*pp)->next){
+        if(krefcount((*pp)->pa) == 1){
+          t = *pp;
+          *pp = t->next;
+          old = t->pa;
+          text.nreclaim++;
+          break;
+        }
+      }
+    }
+    if(t == 0){
+      release(&text.lock);
+      return;
+    }
+  }
+  t->dev = ip->dev;
+  t->inum = ip->inum;
+  t->off = off;
+  t->n = n;
+  t->pa = pa;
+  kref(pa);
+  pp = textbucket(ip->dev, ip->inum);
+  t->next = *pp;
+  *pp = t;
+  release(&text.lock);
+
+  if(old)
+    kfree(old);
+}
+
+// Drop all cached pages of ip, whose contents are changing.
+// Called with ip->lock held.
+void
+textinval(struct inode *ip)
+{
+  struct textpage *t, **pp, *dead;
+
+  dead = 0;
+  acquire(&text.lock);
+  for(pp = textbucket(ip->dev, ip->inum); *pp; ){
+    t = *pp;
+    if(t->dev == ip->dev && t->inum == ip->inum){
+      *pp = t->next;
+      t->next = dead;
+      dead = t;
+      text.ninval++;
+    } else {
+      pp = &t->next;
+    }
+  }
+  release(&text.lock);
+  textrelease(dead);
+}
+
+// Free the pages that no process maps any more.
+// Called by kalloc() when memory runs out.
+// Returns the number of pages freed.
+int
+textreclaim(void)
+{
+  struct textpage *t, **pp, *dead;
+  int i, n;
+
+  dead = 0;
+  n = 0;
+  acquire(&text.lock);
+  for(i = 0; i < NTEXTBUCKET; i++){
+    for(pp = &text.bucket[i]; *pp; ){
+      t = *pp;
+      if(krefcount(t->pa) == 1){
+        *pp = t->next;
+        t->next = dead;
+        dead = t;
+        n++;
+      } else {
+        pp = &t->next;
+      }
+    }
+  }
+  text.nreclaim += n;
+  release(&text.lock);
+  textrelease(dead);
+  return n;
+}
+
+// Drop the cache's reference to the pages of a chain of
+// entries taken out of their buckets, and recycle the entries.
+// The pages are freed without text.lock held, since kfree()
+// takes allocator locks.
+static void
+textrelease(struct textpage *dead)
+{
+  struct textpage *t, *last;
+  int n;
+
+  if(dead == 0)
+    return;
+  n = 0;
+  last = dead;
+  for(t = dead; t; t = t->next){
+    kfree(t->pa);
+    t->pa = 0;
+    last = t;
+    n++;
+  }
+  acquire(&text.lock);
+  text.ncached -= n;
+  last->next = text.freelist;
+  text.freelist = dead;
+  release(&text.lock);
+}
+
+// Format text cache statistics into buf, for the
+// statistics device. Returns the number of bytes used.
+int
+textstats(char *buf, int sz)
+{
+  return snprintf(buf, sz, "text: cached %d hit %d miss %d reclaim %d inval %d\n",
+                  text.ncached, text.nhit, text.nmiss, text.nreclaim, text.ninval);
+}
@@ -0,0 +1,106 @@
+//
+// Timeouts, in clock ticks. Pending timers are kept in a
+// timing wheel: slot i holds the timers whose expiry tick is
+// i modulo NWHEEL, so clockintr() looks only at the timers
+// of one slot, which mostly are due, instead of waking every
+// sleeper to check its own deadline. A timer more than NWHEEL
+// ticks away is passed over once per turn of the wheel.
+//
+// tickslock protects the wheel, and callers of timerstart()
+// and timerstop() must hold it, so that they can go on to
+// sleep on tickslock without missing the timer's wakeup.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "timer.h"
+#include "defs.h"
+
+#define NWHEEL 64
+
+static struct timer *wheel[NWHEEL];
+
+// Arrange for fn(arg) to be called from clockintr(), with
+// tickslock held, n ticks from now. fn may be wakeup().
+// Caller must hold tickslock.
+void
+timerstart(struct timer *t, uint n, void (*fn)(void*), void *arg)
+{
+  struct timer **slot;
+
+  if(!holding(&tickslock))
+    panic("timerstart");
+  if(t->pending)
+    panic("timerstart: pending");
+  // the slot for this tick has already been looked at.
+  if(n == 0)
+    n = 1;
+  t->expires = ticks + n;
+  t->fn = fn;
+  t->arg = arg;
+  t->pending = 1;
+  slot = &wheel[t->expires % NWHEEL];
+  t->next = *slot;
+  *slot = t;
+}
+
+// Cancel t if it has not fired yet.
+// Caller must hold tickslock.
+void
+timerstop(struct timer *t)
+{
+  struct timer **pp;
+
+  if(!holding(&tickslock))
+    panic("timerstop");
+  if(!t->pending)
+    return;
+  for(pp = &wheel[t->expires % NWHEEL]; *pp; pp = &(*pp)->next){
+    if(*pp == t){
+      *pp = t->next;
+      break;
+    }
+  }
+  t->pending = 0;
+}
+
+// Find the tick at which the next timer fires, for an idle
+// CPU. Returns 0 and sets *when, or -1 if none is pending.
+// Caller must hold tickslock.
+int
+timernext(uint *when)
+{
+  struct timer *t, *first;
+  int i;
+
+  first = 0;
+  for(i = 0; i < NWHEEL; i++)
+    for(t = wheel[i]; t; t = t->next)
+      if(first == 0 || (int)(t->expires - first->expires) < 0)
+        first = t;
+  if(first == 0)
+    return -1;
+  *when = first->expires;
+  return 0;
+}
+
+// Fire the timers that are due at this tick.
+// Called by clockintr() with tickslock held.
+void
+timertick(void)
+{
+  struct timer **pp, *t;
+
+  for(pp = &wheel[ticks % NWHEEL]; *pp; ){
+    t = *pp;
+    if((int)(ticks - t->expires) >= 0){
+      *pp = t->next;
+      t->pending = 0;
+      t->fn(t->arg);
+    } else {
+      pp = &t->next;
+    }
+  }
+}
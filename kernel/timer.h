@@ -0,0 +1,9 @@
+// A timeout: fn(arg) is called from clockintr() once ticks
+// reaches expires. See timer.c.
+struct timer {
+  uint expires;          // value of ticks at which it fires
+  void (*fn)(void*);     // called with tickslock held
+  void *arg;
+  int pending;           // in the wheel, not yet fired?
+  struct timer *next;    // in its wheel slot
+};
@@ -8,8 +8,14 @@
 
 struct spinlock tickslock;
 uint ticks;
+static uint64 nexttick;   // mtime at which ticks next goes up
+
+#define Reg(r) ((volatile uint64 *)(r))
 
 extern char trampoline[], uservec[], userret[];
+#ifdef KUSERMAP
+extern char ucopyend[], ucopyfault[];
+#endif
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
@@ -20,6 +26,7 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  nexttick = *Reg(KCLINT_MTIME) + TICKINTERVAL;
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -45,6 +52,11 @@ usertrap(void)
   // since we're now in the kernel.
   w_stvec((uint64)kernelvec);
 
+  // uservec switched page tables, flushing the TLB; let
+  // a tlbshootdown() waiting for this CPU go on.
+  mycpu()->inuser = 0;
+  mycpu()->ntrap++;
+
   struct proc *p = myproc();
   
   // save user program counter.
@@ -67,6 +79,18 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // instruction, load or store page fault. uvmfault() may
+    // sleep reading the page from a file, so turn on interrupts,
+    // but first save stval, which an interrupt would change.
+    uint64 scause = r_scause();
+    uint64 va = r_stval();
+    intr_on();
+    if(uvmfault(p->pagetable, va, scause == 15) != 0){
+      printf("usertrap(): unexpected scause %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, va);
+      p->killed = 1;
+    }
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -121,11 +145,16 @@ usertrapret(void)
   // tell trampoline.S the user page table to switch to.
   uint64 satp = MAKE_SATP(p->pagetable);
 
+  // tlbshootdown() must interrupt this CPU from now on.
+  mycpu()->inuser = 1;
+  __sync_synchronize();
+
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
-  // and switches to user mode with sret.
+  // and switches to user mode with sret. each thread of the
+  // process has its own trapframe address.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->tfva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -143,6 +172,17 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
+#ifdef KUSERMAP
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)ucopy && sepc < (uint64)ucopyend){
+    // a user page that is not mapped yet, or is
+    // copy-on-write: let copyin() or copyout() fall
+    // back on the page table walk, which faults it in.
+    w_sepc((uint64)ucopyfault);
+    return;
+  }
+#endif
+
   if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -162,12 +202,61 @@ kerneltrap()
 void
 clockintr()
 {
+  uint64 now = *Reg(KCLINT_MTIME);
+
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  // every CPU calls clockintr(), and when all of them
+  // have been idle several ticks may be due at once.
+  while(now >= nexttick){
+    ticks++;
+    timertick();
+    nexttick += TICKINTERVAL;
+  }
   release(&tickslock);
 }
 
+// Stop this CPU's periodic timer interrupts while it idles,
+// leaving only one for the next timer deadline, if any.
+void
+clockidle(void)
+{
+  uint64 when;
+  uint next;
+
+  when = ~0L;
+  acquire(&tickslock);
+  if(timernext(&next) == 0){
+    when = nexttick;
+    if((int)(next - ticks) > 1)
+      when += (uint64)(next - ticks - 1) * TICKINTERVAL;
+  }
+  release(&tickslock);
+  *Reg(KCLINT_MTIMECMP(cpuid())) = when;
+}
+
+// Restart this CPU's periodic timer interrupts after
+// idling, and bring ticks up to date.
+void
+clockbusy(void)
+{
+  *Reg(KCLINT_MTIMECMP(cpuid())) = *Reg(KCLINT_MTIME) + TICKINTERVAL;
+  clockintr();
+}
+
+// The current mtime, which counts TIMEBASE times a second.
+uint64
+clocknow(void)
+{
+  return *Reg(KCLINT_MTIME);
+}
+
+// Give CPU id, which may be idle, a timer interrupt now.
+void
+clockkick(int id)
+{
+  *Reg(KCLINT_MTIMECMP(id)) = *Reg(KCLINT_MTIME);
+}
+
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
@@ -202,12 +291,10 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // forwarded by timervec in kernelvec.S. any CPU that is
+    // not idle may be the one to move ticks on.
+    clockintr();
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
@@ -44,8 +44,10 @@
 #define VIRTIO_RING_F_EVENT_IDX     29
 
 // this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// must be a power of two. each disk request takes three,
+// so NUM/3 requests can be in flight at once. the
+// descriptors and avail ring must fit in the first page.
+#define NUM 64
 
 struct VRingDesc {
   uint64 addr;
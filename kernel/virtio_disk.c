@@ -20,12 +20,18 @@
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
+// the first descriptor of a request, which qemu's
+// virtio-blk.c reads.
+struct virtio_blk_outhdr {
+  uint32 type;
+  uint32 reserved;
+  uint64 sector;
+};
+
 static struct disk {
  // memory for virtio descriptors &c for queue 0.
- // this is a global instead of allocated because it must
- // be multiple contiguous pages, which kalloc()
- // doesn't support, and page aligned.
-  char pages[2*PGSIZE];
+ // two contiguous, page-aligned pages from kalloc_pages().
+  char *pages;
   struct VRingDesc *desc;
   uint16 *avail;
   struct UsedArea *used;
@@ -40,11 +46,13 @@ static struct disk {
   struct {
     struct buf *b;
     char status;
+    char async;     // hand b to breaddone() when finished
+    struct virtio_blk_outhdr hdr;
   } info[NUM];
   
   struct spinlock vdisk_lock;
   
-} __attribute__ ((aligned (PGSIZE))) disk;
+} disk;
 
 void
 virtio_disk_init(void)
@@ -95,7 +103,9 @@ virtio_disk_init(void)
   if(max < NUM)
     panic("virtio disk max queue too short");
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-  memset(disk.pages, 0, sizeof(disk.pages));
+  if((disk.pages = kalloc_pages(1)) == 0)
+    panic("virtio disk kalloc");
+  memset(disk.pages, 0, 2*PGSIZE);
   *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
 
   // desc = pages -- num * VRingDesc
@@ -165,46 +175,26 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// format the three descriptors idx[] for reading or writing
+// b, and hand them to the device. caller holds vdisk_lock.
+static void
+submit(struct buf *b, int write, int *idx)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  struct virtio_blk_outhdr *hdr = &disk.info[idx[0]].hdr;
 
   // the spec says that legacy block operations use three
   // descriptors: one for type/reserved/sector, one for
   // the data, one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-  
-  // format the three descriptors.
-  // qemu's virtio-blk.c reads them.
-
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
-
   if(write)
-    buf0.type = VIRTIO_BLK_T_OUT; // write the disk
+    hdr->type = VIRTIO_BLK_T_OUT; // write the disk
   else
-    buf0.type = VIRTIO_BLK_T_IN; // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk.desc[idx[0]].addr = (uint64) kvmpa((uint64) &buf0);
-  disk.desc[idx[0]].len = sizeof(buf0);
+    hdr->type = VIRTIO_BLK_T_IN; // read the disk
+  hdr->reserved = 0;
+  hdr->sector = b->blockno * (BSIZE / 512);
+
+  disk.desc[idx[0]].addr = (uint64) hdr;
+  disk.desc[idx[0]].len = sizeof(*hdr);
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
@@ -236,31 +226,92 @@ virtio_disk_rw(struct buf *b, int write)
   disk.avail[1] = disk.avail[1] + 1;
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
+// allocate three descriptors and hand the device a request
+// for b. if none are free, wait for some unless nowait, when
+// return -1 instead.
+static int
+start(struct buf *b, int write, int async, int nowait)
+{
+  int idx[3];
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  acquire(&disk.vdisk_lock);
+  while(alloc3_desc(idx) < 0){
+    if(nowait){
+      release(&disk.vdisk_lock);
+      return -1;
+    }
+    sleep(&disk.free[0], &disk.vdisk_lock);
+  }
+  disk.info[idx[0]].async = async;
+  submit(b, write, idx);
+  release(&disk.vdisk_lock);
+  return 0;
+}
+
+// Queue a request to read (write is 0) or write locked
+// buffer b, and return without waiting for it to finish;
+// waits only if every descriptor is in use. Many requests
+// can be in flight at once. The caller must keep b locked
+// and call virtio_disk_wait(b) before using b->data.
+void
+virtio_disk_submit(struct buf *b, int write)
+{
+  start(b, write, 0, 0);
+}
+
+// Wait for the request for b to finish.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
+  release(&disk.vdisk_lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(b, write);
+  virtio_disk_wait(b);
+}
 
-  release(&disk.vdisk_lock);
+// Start reading locked buffer b, for read-ahead, and return
+// without waiting; virtio_disk_intr() passes b to breaddone()
+// once the data is there. Returns -1, and leaves b alone, if
+// no descriptors are free: read-ahead must not wait.
+int
+virtio_disk_readahead(struct buf *b)
+{
+  return start(b, 0, 1, 1);
 }
 
 void
 virtio_disk_intr()
 {
+  struct buf *b;
+
   acquire(&disk.vdisk_lock);
 
+  // reap every request that has finished since the last
+  // interrupt; the device may complete several at once.
   while((disk.used_idx % NUM) != (disk.used->id % NUM)){
     int id = disk.used->elems[disk.used_idx].id;
 
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
     
-    disk.info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk.info[id].b);
+    b = disk.info[id].b;
+    disk.info[id].b = 0;
+    free_chain(id);
+    b->disk = 0;   // disk is done with buf
+    if(disk.info[id].async)
+      breaddone(b);
+    else
+      wakeup(b);
 
     disk.used_idx = (disk.used_idx + 1) % NUM;
   }
@@ -3,6 +3,10 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "vmspace.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -10,19 +14,32 @@
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
+static struct spinlock kvmlock;  // for changes after booting
 
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+#define SUPERORDER 9  // log2(SUPERPGSIZE / PGSIZE), for kalloc_pages()
+
+// a superpage may not take memory from the last quarter of RAM,
+// so that a sparsely touched heap cannot use it all up.
+#define SUPERRESERVE ((PHYSTOP - KERNBASE) / PGSIZE / 4)
+
+static struct {
+  int nsuper;   // user superpages allocated
+  int nfail;    // superpages wanted but not available
+  int nsplit;   // superpage mappings split into pages
+} vmstat;
+
 /*
  * create a direct-map page table for the kernel.
  */
 void
 kvminit()
 {
-  kernel_pagetable = (pagetable_t) kalloc();
-  memset(kernel_pagetable, 0, PGSIZE);
+  initlock(&kvmlock, "kvm");
+  kernel_pagetable = (pagetable_t) kzalloc();
 
   // uart registers
   kvmmap(UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -31,7 +48,7 @@ kvminit()
   kvmmap(VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
   // CLINT
-  kvmmap(CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+  kvmmap(KCLINT, CLINT, 0x10000, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(PLIC, PLIC, 0x400000, PTE_R | PTE_W);
@@ -40,11 +57,20 @@ kvminit()
   kvmmap(KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // mappages() uses superpages from the first 2-megabyte
+  // boundary on.
   kvmmap((uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
   kvmmap(TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+  // make the page-table pages for every kernel stack slot
+  // now, so that stacks can come and go without the kernel
+  // page table growing, and so that they are shared by every
+  // process's kernel page table.
+  for(int i = 0; i < NPROC; i++)
+    if(walk(kernel_pagetable, KSTACK(i), 1) == 0)
+      panic("kvminit");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -56,6 +82,77 @@ kvminithart()
   sfence_vma();
 }
 
+#ifdef KUSERMAP
+// Make a kernel page table for a process. It shares all of
+// the kernel's page-table pages except the one for the lowest
+// gigabyte, where the process's user memory lies below the
+// devices; kvmuser() fills in that part.
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t kpagetable, l1, kl1;
+  int i;
+
+  if((kpagetable = (pagetable_t)kalloc()) == 0)
+    return 0;
+  if((l1 = (pagetable_t)kzalloc()) == 0){
+    kfree(kpagetable);
+    return 0;
+  }
+  pagecopy(kpagetable, kernel_pagetable);
+  kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+  for(i = PX(1, MAXUVA); i < 512; i++)
+    l1[i] = kl1[i];
+  kpagetable[0] = PA2PTE(l1) | PTE_V;
+  return kpagetable;
+}
+
+// Free a process's kernel page table. The pages it shares
+// with the kernel and with the user page table stay.
+void
+kvmfree(pagetable_t kpagetable)
+{
+  kfree((void*)PTE2PA(kpagetable[0]));
+  kfree(kpagetable);
+}
+
+// Can [va, va+len) of pagetable be reached by address,
+// through the current process's kernel page table? If so,
+// first point the kernel page table's level-1 PTEs for the
+// range at the user page table's own level-0 pages (or
+// superpages), so that later changes to single pages show
+// through without any copying. Not if other threads share
+// the page table: one could unmap and free a page in the
+// middle of a copy, which the slow path prevents.
+static int
+kvmuser(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  pagetable_t ul1, kl1;
+  uint64 a;
+  pte_t pte;
+  int changed;
+
+  if(p == 0 || p->pagetable != pagetable || p->vm->ref > 1)
+    return 0;
+  if(va + len < va || va + len > MAXUVA)
+    return 0;
+  ul1 = (pagetable[0] & PTE_V) ? (pagetable_t)PTE2PA(pagetable[0]) : 0;
+  kl1 = (pagetable_t)PTE2PA(p->kpagetable[0]);
+  changed = 0;
+  for(a = SUPERPGROUNDDOWN(va); a < va + len; a += SUPERPGSIZE){
+    pte = ul1 ? ul1[PX(1, a)] : 0;
+    if(kl1[PX(1, a)] != pte){
+      kl1[PX(1, a)] = pte;
+      changed = 1;
+    }
+  }
+  if(changed)
+    sfence_vma();
+  return 1;
+}
+#endif
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -68,6 +165,9 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// If va lies in a superpage, the level-1 leaf PTE that
+// maps it is returned instead.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
@@ -77,17 +177,88 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// Return the address of the level-1 PTE for va, which
+// maps a whole superpage if it is a leaf. If alloc!=0,
+// create the level-1 page-table page if needed.
+static pte_t *
+walk1(pagetable_t pagetable, uint64 va, int alloc)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    panic("walk1");
+
+  pte = &pagetable[PX(2, va)];
+  if(*pte & PTE_V) {
+    if(PTE_LEAF(*pte))
+      return 0;
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if(!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
+      return 0;
+    *pte = PA2PTE(pagetable) | PTE_V;
+  }
+  return &pagetable[PX(1, va)];
+}
+
+// Return the level-1 leaf PTE if va lies in a superpage,
+// or 0.
+static pte_t *
+walksuper(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  pte = walk1(pagetable, va, 0);
+  if(pte && (*pte & PTE_V) && PTE_LEAF(*pte))
+    return pte;
+  return 0;
+}
+
+// The physical address of the page that PTE pte,
+// found by walk(), maps at va.
+static uint64
+pteaddr(pagetable_t pagetable, pte_t *pte, uint64 va)
+{
+  if(walksuper(pagetable, va) == pte)
+    return PTE2PA(*pte) + (PGROUNDDOWN(va) & (SUPERPGSIZE-1));
+  return PTE2PA(*pte);
+}
+
+// Map the superpage that level-1 PTE pte maps with 512
+// ordinary PTEs instead, in page-table page l0, or in a
+// new one if l0 is 0. Its physical pages are already
+// counted one by one (see ksplit()), so no references
+// change. Returns 0, or -1 if out of memory.
+static int
+splitsuper(pte_t *pte, pagetable_t l0)
+{
+  uint64 pa;
+  uint flags;
+  int i;
+
+  if(l0 == 0 && (l0 = (pagetable_t)kalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = PTE_FLAGS(*pte);
+  for(i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(l0) | PTE_V;
+  __sync_fetch_and_add(&vmstat.nsplit, 1);
+  return 0;
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -107,7 +278,7 @@ walkaddr(pagetable_t pagetable, uint64 va)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = pteaddr(pagetable, pte, va);
   return pa;
 }
 
@@ -121,6 +292,38 @@ kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
     panic("kvmmap");
 }
 
+// map a kernel stack page at va, for a process made after
+// booting. kvminit() made the page-table pages, which every
+// process's kernel page table shares. the caller sees to it
+// that other CPUs flush their TLBs before they use it.
+void
+kvmmapstack(uint64 va, uint64 pa)
+{
+  acquire(&kvmlock);
+  if(mappages(kernel_pagetable, va, PGSIZE, pa, PTE_R | PTE_W) != 0)
+    panic("kvmmapstack");
+  release(&kvmlock);
+}
+
+// unmap the kernel stack page at va, which no CPU is using,
+// and free it. other CPUs may still have it in their TLBs,
+// so va must not be used until it is mapped again.
+void
+kvmunmapstack(uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  acquire(&kvmlock);
+  if((pte = walk(kernel_pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+    panic("kvmunmapstack");
+  pa = PTE2PA(*pte);
+  *pte = 0;
+  release(&kvmlock);
+  sfence_vma();
+  kfree((void*)pa);
+}
+
 // translate a kernel virtual address to
 // a physical address. only needed for
 // addresses on the stack.
@@ -137,14 +340,16 @@ kvmpa(uint64 va)
     panic("kvmpa");
   if((*pte & PTE_V) == 0)
     panic("kvmpa");
-  pa = PTE2PA(*pte);
+  pa = pteaddr(kernel_pagetable, pte, va);
   return pa+off;
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
-// allocate a needed page-table page.
+// be page-aligned. Where va and pa are both superpage-aligned,
+// at least a superpage remains, and nothing is mapped there yet,
+// a single superpage PTE is used. Returns 0 on success, -1 if
+// walk() couldn't allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
@@ -154,6 +359,19 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
+    if(a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 &&
+       last - a >= SUPERPGSIZE - PGSIZE){
+      if((pte = walk1(pagetable, a, 1)) == 0)
+        return -1;
+      if((*pte & PTE_V) == 0){
+        *pte = PA2PTE(pa) | perm | PTE_V;
+        if(last - a == SUPERPGSIZE - PGSIZE)
+          break;
+        a += SUPERPGSIZE;
+        pa += SUPERPGSIZE;
+        continue;
+      }
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -167,23 +385,69 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Split the superpages that [va, end) covers only partly,
+// at most the ones holding va and end-1, so that unmapping
+// or revoking the range can go ahead without allocating.
+// Splitting leaves every mapping as it was.
+// Returns 0, or -1 if out of memory.
+int
+uvmsplit(pagetable_t pagetable, uint64 va, uint64 end)
+{
+  pte_t *pte;
+
+  if(va >= end)
+    return 0;
+  if((pte = walksuper(pagetable, va)) != 0 &&
+     (va % SUPERPGSIZE != 0 || va + SUPERPGSIZE > end) &&
+     splitsuper(pte, 0) < 0)
+    return -1;
+  if((pte = walksuper(pagetable, end - PGSIZE)) != 0 &&
+     end % SUPERPGSIZE != 0 && splitsuper(pte, 0) < 0)
+    return -1;
+  return 0;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never mapped (because a
+// lazily grown heap never touched them) are skipped.
+// A superpage that is only partly unmapped is split first.
 // Optionally free the physical memory.
-void
+// Returns 0, or -1 if out of memory for the split, in which
+// case nothing has been unmapped.
+int
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end, pa;
   pte_t *pte;
+  int i;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+  end = va + npages*PGSIZE;
+  if(uvmsplit(pagetable, va, end) < 0)
+    return -1;
+  for(a = va; a < end; a += PGSIZE){
+    if((pte = walksuper(pagetable, a)) != 0){
+      if(a % SUPERPGSIZE != 0 || a + SUPERPGSIZE > end)
+        panic("uvmunmap: partial superpage");
+      if(do_free){
+        pa = PTE2PA(*pte);
+        for(i = 0; i < 512; i++)
+          kfree((void*)(pa + i*PGSIZE));
+      }
+      *pte = 0;
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    if((pte = walk(pagetable, a, 0)) == 0){
+      // no page-table page, so nothing mapped in the rest
+      // of the 2-megabyte range it would have covered.
+      a = (((a >> PXSHIFT(1)) + 1) << PXSHIFT(1)) - PGSIZE;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -192,6 +456,39 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     }
     *pte = 0;
   }
+  return 0;
+}
+
+// Take away user access to npages of pages from va, ahead
+// of unmapping them while other threads of the process may
+// still be using them. After a tlbshootdown() no thread can
+// reach them, even through a stale TLB entry. A superpage
+// that is only partly revoked is split.
+// Returns 0, or -1 if out of memory.
+int
+uvmrevoke(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  uint64 a, end;
+  pte_t *pte;
+
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a += PGSIZE){
+    if((pte = walksuper(pagetable, a)) != 0){
+      if(a % SUPERPGSIZE == 0 && a + SUPERPGSIZE <= end){
+        *pte &= ~PTE_U;
+        a += SUPERPGSIZE - PGSIZE;
+        continue;
+      }
+      if(splitsuper(pte, 0) < 0)
+        return -1;
+    }
+    if((pte = walk(pagetable, a, 0)) == 0){
+      a = (((a >> PXSHIFT(1)) + 1) << PXSHIFT(1)) - PGSIZE;
+      continue;
+    }
+    *pte &= ~PTE_U;
+  }
+  return 0;
 }
 
 // create an empty user page table.
@@ -200,10 +497,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kzalloc();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -217,8 +513,7 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -236,12 +531,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -254,7 +548,8 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or oldsz if out
+// of memory for splitting a superpage.
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
@@ -263,7 +558,8 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
-    uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
+    if(uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1) < 0)
+      return oldsz;
   }
 
   return newsz;
@@ -294,58 +590,321 @@ freewalk(pagetable_t pagetable)
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
-  if(sz > 0)
-    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+  // superpages lie wholly below sz, so none needs a split.
+  if(sz > 0 && uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1) < 0)
+    panic("uvmfree");
   freewalk(pagetable);
 }
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies the page table, but shares the physical
+// memory: writable pages become read-only and
+// copy-on-write in both parent and child, and
+// cowfault() copies them when either one writes.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmshare(old, new, 0, sz, 0);
+}
+
+// Map the pages that old maps between va and end into new too.
+// If shared is 0, writable pages become copy-on-write in both,
+// as for uvmcopy(); otherwise both keep writing the same pages,
+// as for a MAP_SHARED mmap().
+// returns 0 on success, -1 on failure.
+// frees any allocated pages on failure.
+int
+uvmshare(pagetable_t old, pagetable_t new, uint64 va, uint64 end, int shared)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
+  int j;
 
-  for(i = 0; i < sz; i += PGSIZE){
+  for(i = va; i < end; i += PGSIZE){
+    if((pte = walksuper(old, i)) != 0){
+      if(i % SUPERPGSIZE == 0 && i + SUPERPGSIZE <= end){
+        // share the whole superpage.
+        if(!shared && (*pte & PTE_W))
+          *pte = (*pte & ~PTE_W) | PTE_COW;
+        pa = PTE2PA(*pte);
+        flags = PTE_FLAGS(*pte);
+        if(mappages(new, i, SUPERPGSIZE, pa, flags) != 0)
+          goto err;
+        for(j = 0; j < 512; j++)
+          kref((void*)(pa + j*PGSIZE));
+        i += SUPERPGSIZE - PGSIZE;
+        continue;
+      }
+      if(splitsuper(pte, 0) < 0)
+        goto err;
+    }
+    // skip pages that were never touched.
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if(!shared && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    kref((void*)pa);
   }
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
   return -1;
 }
 
+// Handle a write to the copy-on-write page at va:
+// give the page table its own writable copy, or, if
+// nothing else refers to the page any more, just
+// make it writable again.
+// Returns 0 on success, -1 if va is not a
+// copy-on-write page or memory is exhausted.
+int
+cowfault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+  int i;
+
+  if(va >= MAXVA)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  if(walksuper(pagetable, va) == pte){
+    // if no other process shares any of the superpage,
+    // it stays whole; otherwise copy just the one page.
+    pa = PTE2PA(*pte);
+    for(i = 0; i < 512; i++)
+      if(krefcount((void*)(pa + i*PGSIZE)) != 1)
+        break;
+    if(i == 512){
+      *pte = (*pte & ~PTE_COW) | PTE_W;
+      return 0;
+    }
+    if(splitsuper(pte, 0) < 0)
+      return -1;
+    pte = walk(pagetable, va, 0);
+  }
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if(krefcount((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  pagecopy(mem, (char*)pa);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  return 0;
+}
+
+// Handle a page fault at user virtual address va in
+// pagetable, for usertrap() or for a kernel copy to or
+// from user memory. write is 1 for a store.
+// Reads in a page of the program that exec() left in its
+// file or of an mmap()ed area, maps a zeroed page for a heap
+// page that sbrk() grew lazily, or copies a copy-on-write
+// page on a store.
+// May sleep. Returns 0 if va is now mapped, or -1 if the
+// access is illegal or memory is exhausted.
+int
+uvmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct vmspace *vm;
+  struct vma *v;
+  pte_t *pte;
+  uint64 lo;
+  char *mem;
+  int r;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  // only the current process's own memory is filled lazily.
+  if(p == 0 || p->pagetable != pagetable){
+    pte = walk(pagetable, va, 0);
+    if(pte && (*pte & PTE_V) && write && (*pte & PTE_COW))
+      return cowfault(pagetable, va);
+    return -1;
+  }
+
+  // other threads may be faulting on the same page.
+  vm = p->vm;
+  acquire(&vm->lock);
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    r = -1;
+    if(write && (*pte & PTE_COW)){
+      r = cowfault(pagetable, va);
+      // other threads may still have the old page in their TLBs.
+      if(r == 0 && vm->ref > 1)
+        tlbshootdown(vm);
+    } else if((*pte & PTE_U) && (!write || (*pte & PTE_W))){
+      // another thread has already filled in the page, or
+      // made it writable, and this CPU's TLB had the old PTE.
+      sfence_vma();
+      r = 0;
+    }
+    goto out;
+  }
+
+  // mmap()ed areas lie above vm->sz; the program and heap below.
+  if((v = vmafind(p, va)) != 0 && (v->flags || va < vm->sz)){
+    r = -1;
+    if(!write || (v->prot & PTE_W))
+      r = vmafault(p, va);
+    goto out;
+  }
+  r = -1;
+  if(va >= vm->sz)
+    goto out;
+  // a heap region of superpage size is given a superpage
+  // at its first touch, unless a program area is in it.
+  r = 0;
+  lo = SUPERPGROUNDDOWN(va);
+  if(!vmaoverlap(p, lo, lo + SUPERPGSIZE) &&
+     uvmsuper(pagetable, va, 0, vm->sz, PTE_W|PTE_X|PTE_R|PTE_U) == 0)
+    goto out;
+  r = -1;
+  if((mem = kzalloc()) == 0)
+    goto out;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    goto out;
+  }
+  r = 0;
+
+ out:
+  release(&vm->lock);
+  return r;
+}
+
+// Find the physical address behind user address va for a
+// copy to (write=1) or from user memory, first faulting in
+// a lazily allocated or copy-on-write page if needed.
+// Returns 0 if va is not accessible. If other threads share
+// the page table, one could unmap the page during the copy,
+// so the page is given an extra reference, which the caller
+// drops with kfree(), and *pinned is set.
+uint64
+uvmaddr(pagetable_t pagetable, uint64 va, int write, int *pinned)
+{
+  struct proc *p = myproc();
+  struct vmspace *vm;
+  pte_t *pte;
+  uint64 pa;
+
+  *pinned = 0;
+  if(va >= MAXVA)
+    return 0;
+  vm = 0;
+  if(p && p->pagetable == pagetable && p->vm->ref > 1){
+    vm = p->vm;
+    acquire(&vm->lock);
+  }
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_COW))){
+    if(vm)
+      release(&vm->lock);
+    if(uvmfault(pagetable, va, write) != 0)
+      return 0;
+#ifdef KUSERMAP
+    // the kernel page table may have the old PTE cached.
+    sfence_vma();
+#endif
+    if(vm)
+      acquire(&vm->lock);
+    pte = walk(pagetable, va, 0);
+  }
+  pa = 0;
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    goto out;
+  if(write && (*pte & PTE_W) == 0)
+    goto out;
+  // the kernel writes through its own mapping, so mark the
+  // page dirty as a user store would, for munmap().
+  if(write)
+    *pte |= PTE_D;
+  pa = pteaddr(pagetable, pte, va);
+  if(vm){
+    kref((void*)pa);
+    *pinned = 1;
+  }
+
+ out:
+  if(vm)
+    release(&vm->lock);
+  return pa;
+}
+
+// Map a zeroed superpage at the superpage boundary below va,
+// if all of it lies within [lo, hi), none of it is mapped yet,
+// and memory is plentiful. Its pages are counted one by one,
+// so that they can be shared, copied and freed singly once
+// the superpage is split. Returns 0, or -1 if no superpage was
+// mapped and the caller should map an ordinary page.
+int
+uvmsuper(pagetable_t pagetable, uint64 va, uint64 lo, uint64 hi, int perm)
+{
+  uint64 a;
+  pte_t *pte;
+  char *mem;
+  int i;
+
+  a = SUPERPGROUNDDOWN(va);
+  if(a < lo || a + SUPERPGSIZE > hi)
+    return -1;
+  if((pte = walk1(pagetable, a, 0)) != 0 && (*pte & PTE_V))
+    return -1;
+  if(kfreecount() < SUPERRESERVE + 512 ||
+     (mem = kalloc_pages(SUPERORDER)) == 0){
+    __sync_fetch_and_add(&vmstat.nfail, 1);
+    return -1;
+  }
+  memset(mem, 0, SUPERPGSIZE);
+  ksplit(mem, SUPERORDER);
+  if(mappages(pagetable, a, SUPERPGSIZE, (uint64)mem, perm) != 0){
+    for(i = 0; i < 512; i++)
+      kfree(mem + i*PGSIZE);
+    return -1;
+  }
+  __sync_fetch_and_add(&vmstat.nsuper, 1);
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
-void
+// Returns 0, or -1 if out of memory for splitting a superpage.
+int
 uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   
+  if((pte = walksuper(pagetable, va)) != 0 && splitsuper(pte, 0) < 0)
+    return -1;
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
   *pte &= ~PTE_U;
+  return 0;
 }
 
 // Copy from kernel to user.
@@ -355,16 +914,24 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  int pinned;
+
+#ifdef KUSERMAP
+  if(kvmuser(pagetable, dstva, len) && ucopy((char*)dstva, src, len) == 0)
+    return 0;
+#endif
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 1, &pinned);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
     memmove((void *)(pa0 + (dstva - va0)), src, n);
+    if(pinned)
+      kfree((void*)pa0);
 
     len -= n;
     src += n;
@@ -380,16 +947,24 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  int pinned;
+
+#ifdef KUSERMAP
+  if(kvmuser(pagetable, srcva, len) && ucopy(dst, (char*)srcva, len) == 0)
+    return 0;
+#endif
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0, &pinned);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
     memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    if(pinned)
+      kfree((void*)pa0);
 
     len -= n;
     dst += n;
@@ -406,11 +981,19 @@ int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
-  int got_null = 0;
+  int got_null = 0, pinned;
+
+#ifdef KUSERMAP
+  if(srcva < MAXUVA){
+    n = max < MAXUVA - srcva ? max : MAXUVA - srcva;
+    if(kvmuser(pagetable, srcva, n) && ucopystr(dst, (char*)srcva, n) == 0)
+      return 0;
+  }
+#endif
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0, &pinned);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -431,6 +1014,8 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       p++;
       dst++;
     }
+    if(pinned)
+      kfree((void*)pa0);
 
     srcva = va0 + PGSIZE;
   }
@@ -440,3 +1025,12 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
     return -1;
   }
 }
+
+// Format superpage statistics into buf, for the
+// statistics device. Returns the number of bytes used.
+int
+vmstats(char *buf, int sz)
+{
+  return snprintf(buf, sz, "vm: superpages %d nosuper %d split %d\n",
+                  vmstat.nsuper, vmstat.nfail, vmstat.nsplit);
+}
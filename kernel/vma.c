@@ -0,0 +1,548 @@
+//
+// File-backed memory areas. exec() describes each loadable
+// segment of a program with a struct vma instead of reading
+// it into memory, mmap() adds areas backed by a file or by
+// zeroed memory, and uvmfault() calls vmafault() to fill in
+// each page the first time it is touched.
+//
+// The program's areas lie below vm->sz and its pages are freed
+// with the rest of the process's memory. mmap()ed areas are
+// placed top-down from MAXUVA, above anything sbrk()
+// may grow into, and munmap() or exit() write back the dirty
+// pages of a MAP_SHARED file mapping.
+//
+// The areas belong to the process's struct vmspace, which
+// its threads share: vm->lock must be held to look at them.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "vmspace.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+// Return the area of p that contains va, or 0.
+struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+    if(v->end && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Does any area of p overlap [start, end)?
+int
+vmaoverlap(struct proc *p, uint64 start, uint64 end)
+{
+  struct vma *v;
+
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+    if(v->end && v->start < end && v->end > start)
+      return 1;
+  return 0;
+}
+
+static struct vma*
+vmaalloc(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+    if(v->end == 0)
+      return v;
+  return 0;
+}
+
+// Read in the page of p's area that contains va, and map
+// it. Read-only pages are shared with every other process
+// mapping the same file, through the text cache; writable
+// pages are private. Anonymous memory comes a superpage at
+// a time where the area is big enough. Called and returns
+// with p->vm->lock held, but lets go of it to read the file,
+// so may sleep. Returns 0 on success, -1 if there is no
+// area, it may not be accessed at all, or memory is exhausted.
+int
+vmafault(struct proc *p, uint64 va)
+{
+  struct vmspace *vm = p->vm;
+  struct vma *v;
+  struct inode *ip;
+  pte_t *pte;
+  uint64 a;
+  uint off, n;
+  int r, prot;
+  char *mem;
+
+  a = PGROUNDDOWN(va);
+ again:
+  if((v = vmafind(p, a)) == 0 || (v->prot & (PTE_R|PTE_X)) == 0)
+    return -1;
+  // another thread may have got here first.
+  if((pte = walk(vm->pagetable, a, 0)) != 0 && (*pte & PTE_V))
+    return 0;
+
+  off = v->off + (a - v->start);
+  n = 0;
+  if(a - v->start < v->filesz)
+    n = v->filesz - (a - v->start);
+  if(n > PGSIZE)
+    n = PGSIZE;
+
+  if(n == 0){
+    if(v->ip == 0 && uvmsuper(vm->pagetable, a, v->start, v->end, v->prot | PTE_U) == 0)
+      return 0;
+    if((mem = kzalloc()) == 0)
+      return -1;
+    if(mappages(vm->pagetable, a, PGSIZE, (uint64)mem, v->prot | PTE_U) != 0){
+      kfree(mem);
+      return -1;
+    }
+    return 0;
+  }
+
+  // read the page without vm->lock; the area may be
+  // unmapped or replaced meanwhile, so hold on to the file.
+  ip = idup(v->ip);
+  prot = v->prot;
+  release(&vm->lock);
+  ilock(ip);
+  if((prot & PTE_W) || (mem = textget(ip, off, n)) == 0){
+    if((mem = kalloc()) != 0){
+      // past the end of the file reads as zeroes.
+      if((r = readi(ip, 0, (uint64)mem, off, n)) < 0)
+        r = 0;
+      memset(mem + r, 0, PGSIZE - r);
+      if((prot & PTE_W) == 0)
+        textadd(ip, off, n, mem);
+    }
+  }
+  iunlock(ip);
+  acquire(&vm->lock);
+
+  v = vmafind(p, a);
+  if(v == 0 || v->ip != ip || v->prot != prot || v->off + (a - v->start) != off){
+    // the area changed: start over, with whatever is there now.
+    if(mem)
+      kfree(mem);
+    release(&vm->lock);
+    begin_op();
+    iput(ip);
+    end_op();
+    acquire(&vm->lock);
+    goto again;
+  }
+  // v still refers to ip, so this is not the last reference,
+  // and iput() will not sleep.
+  iput(ip);
+  if(mem == 0)
+    return -1;
+  if((pte = walk(vm->pagetable, a, 0)) != 0 && (*pte & PTE_V)){
+    kfree(mem);
+    return 0;
+  }
+  if(mappages(vm->pagetable, a, PGSIZE, (uint64)mem, prot | PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Read in the not yet mapped file-backed pages of p between
+// va and va+n, ahead of a copyin() or copyout() that will run
+// with locks held: a spinlock (a pipe's, or p->lock in wait())
+// forbids sleeping, and an inode's sleep-lock could be the
+// one vmafault() needs. Returns 0, or -1 if a page could
+// not be read in, such as when memory is exhausted: the copy
+// would then fault with those locks held, so must not be
+// tried.
+int
+vmaprefault(struct proc *p, uint64 va, uint64 n)
+{
+  struct vmspace *vm = p->vm;
+  struct vma *v;
+  uint64 a;
+  pte_t *pte;
+  int r;
+
+  if(va + n < va)
+    return 0;
+  r = 0;
+  acquire(&vm->lock);
+  // vmafault() lets go of vm->lock, so v may change under
+  // us; v->end is looked at again for each page.
+  for(v = vm->vma; v < &vm->vma[NVMA]; v++){
+    if(v->end == 0 || v->filesz == 0)
+      continue;
+    a = va > v->start ? PGROUNDDOWN(va) : v->start;
+    for(; a < va + n && a < v->end && a - v->start < v->filesz; a += PGSIZE){
+      if(v->flags == 0 && a >= vm->sz)
+        break;
+      pte = walk(vm->pagetable, a, 0);
+      if(pte && (*pte & PTE_V))
+        continue;
+      if(vmafault(p, a) < 0){
+        r = -1;
+        goto out;
+      }
+    }
+  }
+ out:
+  release(&vm->lock);
+  return r;
+}
+
+// Lowest address of p's mmap()ed areas, which the heap
+// must not grow into. Caller must hold p->vm->lock.
+uint64
+vmabase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base;
+
+  base = MAXUVA;
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+    if(v->end && v->flags && v->start < base)
+      base = v->start;
+  return base;
+}
+
+// Map len bytes of f starting at offset off, or zeroed memory
+// if f is 0, into the current process. prot is a combination
+// of PROT_READ, PROT_WRITE and PROT_EXEC, and flags one of
+// MAP_SHARED and MAP_PRIVATE. Nothing is read until the pages
+// are touched. Returns the address of the mapping, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct vmspace *vm = p->vm;
+  struct vma *v, *nv;
+  uint64 a;
+  int i;
+
+  flags &= MAP_SHARED|MAP_PRIVATE;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(len == 0 || len > MAXUVA || off % PGSIZE != 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if(f){
+    if(f->type != FD_INODE || !f->readable)
+      return -1;
+    if(flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+  acquiresleep(&vm->maplock);
+  acquire(&vm->lock);
+  if((nv = vmaalloc(p)) == 0)
+    goto bad;
+
+  // take the highest free range of user memory.
+  a = MAXUVA - len;
+  for(i = 0; i < NVMA; i++){
+    v = &vm->vma[i];
+    if(v->end && a < v->end && a + len > v->start){
+      // below v, then check all the areas again.
+      if(v->start < len)
+        goto bad;
+      a = v->start - len;
+      i = -1;
+    }
+  }
+  if(a < PGROUNDUP(vm->sz))
+    goto bad;
+
+  nv->start = a;
+  nv->end = a + len;
+  nv->ip = f ? idup(f->ip) : 0;
+  nv->off = off;
+  nv->filesz = f ? len : 0;
+  nv->prot = 0;
+  if(prot & PROT_READ)
+    nv->prot |= PTE_R;
+  if(prot & PROT_WRITE)
+    nv->prot |= PTE_R | PTE_W;
+  if(prot & PROT_EXEC)
+    nv->prot |= PTE_X;
+  nv->flags = flags;
+  release(&vm->lock);
+  releasesleep(&vm->maplock);
+  return a;
+
+ bad:
+  release(&vm->lock);
+  releasesleep(&vm->maplock);
+  return -1;
+}
+
+// Write the page at va of shared file mapping v, whose
+// contents are at pa, back to the file. Only bytes that are
+// already in the file are written; a mapping does not
+// make its file grow.
+static void
+vmawrite(struct vma *v, uint64 va, uint64 pa)
+{
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint off, n, m, tot;
+
+  if(va - v->start >= v->filesz)
+    return;
+  n = v->filesz - (va - v->start);
+  if(n > PGSIZE)
+    n = PGSIZE;
+  off = v->off + (va - v->start);
+
+  // write a few blocks at a time, as filewrite() does,
+  // to stay within a transaction's share of the log.
+  for(tot = 0; tot < n; tot += m){
+    m = n - tot;
+    if(m > max)
+      m = max;
+    begin_op();
+    ilock(v->ip);
+    if(off + tot >= v->ip->size)
+      m = 0;
+    else if(off + tot + m > v->ip->size)
+      m = v->ip->size - (off + tot);
+    if(m > 0)
+      writei(v->ip, 0, pa + tot, off + tot, m);
+    iunlock(v->ip);
+    end_op();
+    if(m == 0)
+      break;
+  }
+}
+
+// Write back the pages in [a, b) of mmap()ed area v that
+// a MAP_SHARED file mapping has dirtied.
+static void
+vmasync(pagetable_t pagetable, struct vma *v, uint64 a, uint64 b)
+{
+  uint64 va;
+  pte_t *pte;
+
+  if(v->ip && v->flags == MAP_SHARED && (v->prot & PTE_W)){
+    for(va = a; va < b; va += PGSIZE){
+      if((pte = walk(pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if(*pte & PTE_D)
+        vmawrite(v, va, PTE2PA(*pte));
+    }
+  }
+}
+
+// Unmap [a, b) of mmap()ed area v from pagetable, first
+// writing back the pages a MAP_SHARED file mapping dirtied.
+static void
+vmaunmap(pagetable_t pagetable, struct vma *v, uint64 a, uint64 b)
+{
+  vmasync(pagetable, v, a, b);
+  uvmunmap(pagetable, a, (b - a) / PGSIZE, 1);
+}
+
+// Remove the mappings of the current process between addr
+// and addr+len. An area may lose its beginning, its end,
+// or, if a free vma slot is left to describe the rest, its
+// middle. Returns 0, or -1 if the arguments are bad or an
+// area could not be split.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vmspace *vm = p->vm;
+  struct vma *v, *nv, gone[NVMA], *g;
+  uint64 a, b, end, d;
+  int r;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr + len < addr)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  // first take the pieces out of vm->vma[], so that other
+  // threads cannot fault their pages back in, into gone[],
+  // to be written back and unmapped without vm->lock.
+  acquiresleep(&vm->maplock);
+  acquire(&vm->lock);
+  r = 0;
+  g = gone;
+  for(v = vm->vma; v < &vm->vma[NVMA]; v++){
+    if(v->end == 0 || v->flags == 0 || v->end <= addr || v->start >= end)
+      continue;
+    a = addr > v->start ? addr : v->start;
+    b = end < v->end ? end : v->end;
+
+    nv = 0;
+    if(a > v->start && b < v->end && (nv = vmaalloc(p)) == 0){
+      r = -1;
+      break;
+    }
+    // split superpages that [a, b) cuts through now, while
+    // giving up still leaves the area as it was.
+    if(uvmsplit(vm->pagetable, a, b) < 0){
+      r = -1;
+      break;
+    }
+    // other threads must stop using the pages.
+    if(vm->ref > 1 && uvmrevoke(vm->pagetable, a, (b - a) / PGSIZE) < 0){
+      r = -1;
+      break;
+    }
+
+    if(nv){
+      // a hole in the middle: the part above it becomes
+      // a new area.
+      *nv = *v;
+      d = b - v->start;
+      nv->start = b;
+      nv->off = v->off + d;
+      nv->filesz = v->filesz > d ? v->filesz - d : 0;
+      if(nv->ip)
+        idup(nv->ip);
+      v->end = b;
+    }
+
+    // g gets [a, b), and its own reference to the file.
+    *g = *v;
+    d = a - v->start;
+    g->start = a;
+    g->end = b;
+    g->off = v->off + d;
+    g->filesz = v->filesz > d ? v->filesz - d : 0;
+    if(a == v->start && b == v->end){
+      v->end = 0;
+      v->ip = 0;
+    } else {
+      if(g->ip)
+        idup(g->ip);
+      if(a == v->start){
+        d = b - v->start;
+        v->start = b;
+        v->off += d;
+        v->filesz = v->filesz > d ? v->filesz - d : 0;
+      } else {
+        v->end = a;
+        if(v->filesz > a - v->start)
+          v->filesz = a - v->start;
+      }
+    }
+    g++;
+  }
+  if(g > gone && vm->ref > 1)
+    tlbshootdown(vm);
+  release(&vm->lock);
+
+  for(v = gone; v < g; v++){
+    vmasync(vm->pagetable, v, v->start, v->end);
+    acquire(&vm->lock);
+    uvmunmap(vm->pagetable, v->start, (v->end - v->start) / PGSIZE, 1);
+    release(&vm->lock);
+    if(v->ip){
+      begin_op();
+      iput(v->ip);
+      end_op();
+    }
+  }
+  releasesleep(&vm->maplock);
+  return r;
+}
+
+// Map every page of p's MAP_SHARED areas, so that a child
+// forked next shares all of them rather than only those p has
+// touched so far. Called by fork() before it takes any locks,
+// since reading pages in may sleep.
+// Returns 0, or -1 if memory is exhausted.
+int
+vmafill(struct proc *p)
+{
+  struct vmspace *vm = p->vm;
+  struct vma *v;
+  uint64 a;
+  pte_t *pte;
+  int r;
+
+  r = 0;
+  acquire(&vm->lock);
+  // vmafault() lets go of vm->lock, so v->end is looked at
+  // again for each page.
+  for(v = vm->vma; v < &vm->vma[NVMA] && r == 0; v++){
+    if(v->end == 0 || v->flags != MAP_SHARED || (v->prot & (PTE_R|PTE_X)) == 0)
+      continue;
+    for(a = v->start; a < v->end; a += PGSIZE){
+      pte = walk(vm->pagetable, a, 0);
+      if(pte && (*pte & PTE_V))
+        continue;
+      if((r = vmafault(p, a)) < 0)
+        break;
+    }
+  }
+  release(&vm->lock);
+  return r;
+}
+
+// Give np a copy of p's areas, for fork(). The mapped pages
+// of mmap()ed areas, which lie above p->vm->sz where uvmcopy()
+// does not look, are shared with np: copy-on-write for
+// MAP_PRIVATE, the very same pages for MAP_SHARED.
+// Caller must hold p->vm->lock.
+// Returns 0, or -1 if memory is exhausted.
+int
+vmadup(struct proc *np, struct proc *p)
+{
+  struct vma *v, *u;
+  int i;
+
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++){
+    if(v->end == 0 || v->flags == 0)
+      continue;
+    if(uvmshare(p->pagetable, np->pagetable, v->start, v->end,
+                v->flags == MAP_SHARED) < 0)
+      goto bad;
+  }
+
+  for(i = 0; i < NVMA; i++){
+    np->vm->vma[i] = p->vm->vma[i];
+    if(p->vm->vma[i].end && p->vm->vma[i].ip)
+      idup(p->vm->vma[i].ip);
+  }
+  return 0;
+
+ bad:
+  for(u = p->vm->vma; u < v; u++)
+    if(u->end && u->flags)
+      uvmunmap(np->pagetable, u->start, (u->end - u->start) / PGSIZE, 1);
+  return -1;
+}
+
+// Release the areas in vma[0..NVMA-1]. mmap()ed areas are
+// written back and unmapped from pagetable; the program's
+// pages are freed with the rest of its memory. No other
+// thread may be using the pagetable.
+void
+vmaclose(struct vma *vma, pagetable_t pagetable)
+{
+  struct vma *v;
+
+  for(v = vma; v < &vma[NVMA]; v++)
+    if(v->end && v->flags)
+      vmaunmap(pagetable, v, v->start, v->end);
+
+  for(v = vma; v < &vma[NVMA]; v++){
+    if(v->end && v->ip){
+      begin_op();
+      iput(v->ip);
+      end_op();
+    }
+    v->end = 0;
+    v->ip = 0;
+  }
+}
@@ -0,0 +1,28 @@
+// A range of user memory that is filled in on first touch,
+// from a file or with zeroes, rather than when it is set up:
+// a segment of the program, or an mmap()ed area.
+struct vma {
+  uint64 start;                // first address, page-aligned
+  uint64 end;                  // one past the last address; 0 if unused
+  struct inode *ip;            // file the contents come from, or 0
+  uint off;                    // file offset of start
+  uint filesz;                 // bytes from the file; the rest is zero
+  int prot;                    // PTE_R, PTE_W, PTE_X
+  int flags;                   // MAP_SHARED or MAP_PRIVATE; 0 for the program
+};
+
+// A process's user memory, which its threads share.
+// lock must be held to change the page table or to look
+// at sz and vma[] while other threads may be running.
+// Faults take only lock. maplock keeps the layout itself
+// (sz and the areas) from changing while munmap() sleeps
+// writing pages back: growproc(), mmap() and munmap() hold it.
+struct vmspace {
+  struct spinlock lock;
+  struct sleeplock maplock;
+  int ref;                     // Threads using it, or 0 if free
+  pagetable_t pagetable;       // User page table
+  uint64 sz;                   // Size of process memory (bytes)
+  struct vma vma[NVMA];        // File-backed memory areas
+  uint tfmap;                  // TRAPFRAMES() slots in use
+};
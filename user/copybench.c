@@ -0,0 +1,83 @@
+//
+// copybench: time read() and write() system calls, whose
+// cost is mostly copying between user and kernel memory.
+// Run it on kernels built with and without KUSERMAP=1 to
+// compare the two ways copyin() and copyout() can work.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define FILESZ (16*1024)  // small enough to stay in the buffer cache
+#define NPIPE 4096        // rounds of 512 bytes through a pipe
+#define NFILE 1024        // reads of the whole file
+
+char buf[FILESZ];
+
+void
+report(char *what, int kb, int ticks)
+{
+  printf("%s: %d KB in %d ticks", what, kb, ticks);
+  if(ticks > 0)
+    printf(", %d KB/tick", kb / ticks);
+  printf("\n");
+}
+
+// write 512 bytes into a pipe and read them back, NPIPE
+// times. pipes copy one byte at a time, so this measures
+// the cost of a copyin() or copyout() call.
+void
+pipebench(void)
+{
+  int fds[2], i, t0;
+
+  if(pipe(fds) < 0){
+    fprintf(2, "copybench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < NPIPE; i++){
+    if(write(fds[1], buf, 512) != 512 || read(fds[0], buf, 512) != 512){
+      fprintf(2, "copybench: pipe i/o failed\n");
+      exit(1);
+    }
+  }
+  report("pipe write+read", NPIPE * 2 * 512 / 1024, uptime() - t0);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// read a cached file NFILE times, a block per copyout().
+void
+filebench(void)
+{
+  char *f = "copybench.tmp";
+  int fd, i, t0;
+
+  if((fd = open(f, O_CREATE | O_RDWR)) < 0 || write(fd, buf, FILESZ) != FILESZ){
+    fprintf(2, "copybench: cannot create %s\n", f);
+    exit(1);
+  }
+  close(fd);
+
+  t0 = uptime();
+  for(i = 0; i < NFILE; i++){
+    if((fd = open(f, O_RDONLY)) < 0 || read(fd, buf, FILESZ) != FILESZ){
+      fprintf(2, "copybench: read %s failed\n", f);
+      exit(1);
+    }
+    close(fd);
+  }
+  report("file read", NFILE * (FILESZ / 1024), uptime() - t0);
+  unlink(f);
+}
+
+int
+main(int argc, char *argv[])
+{
+  pipebench();
+  filebench();
+  exit(0);
+}
@@ -0,0 +1,217 @@
+//
+// tests for lazy allocation of sbrk()ed memory
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+#include "kernel/syscall.h"
+#include "kernel/memlayout.h"
+#include "kernel/riscv.h"
+
+#define REGION_SZ (1024 * 1024 * 1024)
+
+// grow by a gigabyte, far more than physical memory,
+// and touch only every 64th page.
+void
+sparse_memory(char *s)
+{
+  char *i, *prev_end, *new_end;
+
+  prev_end = sbrk(REGION_SZ);
+  if (prev_end == (char*)0xffffffffffffffffL) {
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+  new_end = prev_end + REGION_SZ;
+
+  for (i = prev_end + PGSIZE; i < new_end; i += 64 * PGSIZE)
+    *(char **)i = i;
+
+  for (i = prev_end + PGSIZE; i < new_end; i += 64 * PGSIZE) {
+    if (*(char **)i != i) {
+      printf("failed to read value from memory\n");
+      exit(1);
+    }
+  }
+
+  exit(0);
+}
+
+// pages that were touched and then given back with a
+// negative sbrk() must no longer be accessible.
+void
+sparse_memory_unmap(char *s)
+{
+  int pid;
+  char *i, *prev_end, *new_end;
+
+  prev_end = sbrk(REGION_SZ);
+  if (prev_end == (char*)0xffffffffffffffffL) {
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+  new_end = prev_end + REGION_SZ;
+
+  for (i = prev_end + PGSIZE; i < new_end; i += PGSIZE * PGSIZE)
+    *(char **)i = i;
+
+  for (i = prev_end + PGSIZE; i < new_end; i += PGSIZE * PGSIZE) {
+    pid = fork();
+    if (pid < 0) {
+      printf("error forking\n");
+      exit(1);
+    } else if (pid == 0) {
+      sbrk(-1L * REGION_SZ);
+      *(char **)i = i;
+      exit(0);
+    } else {
+      int status;
+      wait(&status);
+      if (status == 0) {
+        printf("memory not unmapped\n");
+        exit(1);
+      }
+    }
+  }
+
+  exit(0);
+}
+
+// a heap big enough for superpages: copy-on-write after
+// fork() must copy single pages, and shrinking the heap to
+// the middle of a superpage must keep the part below.
+void
+superpages(char *s)
+{
+  char *base, *p;
+  int pid, xstatus;
+  int n = 3 * SUPERPGSIZE;
+
+  base = sbrk(n);
+  if(base == (char*)0xffffffffffffffffL){
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+  for(p = base; p < base + n; p += PGSIZE)
+    *(char**)p = p;
+
+  pid = fork();
+  if(pid < 0){
+    printf("error forking\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = base; p < base + n; p += PGSIZE)
+      if(*(char**)p != p)
+        exit(1);
+    for(p = base; p < base + n; p += 2*PGSIZE)
+      *(char**)p = 0;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("child saw wrong memory\n");
+    exit(1);
+  }
+  for(p = base; p < base + n; p += PGSIZE){
+    if(*(char**)p != p){
+      printf("child's writes visible to parent\n");
+      exit(1);
+    }
+  }
+
+  sbrk(-(n / 2));
+  for(p = base; p < base + n / 2; p += PGSIZE){
+    if(*(char**)p != p){
+      printf("lost memory below the new break\n");
+      exit(1);
+    }
+  }
+  exit(0);
+}
+
+// touching more memory than exists must kill the
+// process, not the kernel.
+void
+oom(char *s)
+{
+  void *m1, *m2;
+  int pid;
+
+  if((pid = fork()) == 0){
+    m1 = 0;
+    while((m2 = malloc(4096*4096)) != 0){
+      for(int i = 0; i < 4096*4096; i += PGSIZE)
+        ((char*)m2)[i] = 1;
+      *(char**)m2 = m1;
+      m1 = m2;
+    }
+    exit(0);
+  } else {
+    int xstatus;
+    wait(&xstatus);
+    exit(xstatus == 0);
+  }
+}
+
+// run each test in its own process. run returns 1 if child's exit()
+// indicates success.
+int
+run(void f(char *), char *s) {
+  int pid;
+  int xstatus;
+
+  printf("running test %s\n", s);
+  if((pid = fork()) < 0) {
+    printf("runtest: fork error\n");
+    exit(1);
+  }
+  if(pid == 0) {
+    f(s);
+    exit(0);
+  } else {
+    wait(&xstatus);
+    if(xstatus != 0)
+      printf("test %s: FAILED\n", s);
+    else
+      printf("test %s: OK\n", s);
+    return xstatus == 0;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *n = 0;
+  if(argc > 1) {
+    n = argv[1];
+  }
+
+  struct test {
+    void (*f)(char *);
+    char *s;
+  } tests[] = {
+    { sparse_memory, "lazy alloc"},
+    { sparse_memory_unmap, "lazy unmap"},
+    { superpages, "superpages"},
+    { oom, "out of memory"},
+    { 0, 0},
+  };
+
+  printf("lazytests starting\n");
+
+  int fail = 0;
+  for (struct test *t = tests; t->s != 0; t++) {
+    if((n == 0) || strcmp(t->s, n) == 0) {
+      fail |= !run(t->f, t->s);
+    }
+  }
+  if(!fail)
+    printf("ALL TESTS PASSED\n");
+  else
+    printf("SOME TESTS FAILED\n");
+  exit(fail);
+}
@@ -0,0 +1,124 @@
+//
+// membench: bytes per cycle of memset(), memmove() and
+// memcmp() on 1K blocks and 4K pages, against the byte
+// loops they used to be.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NROUND 256
+
+char src[2*PGSIZE] __attribute__ ((aligned (PGSIZE)));
+char dst[2*PGSIZE] __attribute__ ((aligned (PGSIZE)));
+
+static inline uint64
+rdcycle(void)
+{
+  uint64 x;
+  asm volatile("rdcycle %0" : "=r" (x));
+  return x;
+}
+
+void*
+bytememset(void *dst, int c, uint n)
+{
+  char *cdst = (char *) dst;
+  int i;
+  for(i = 0; i < n; i++){
+    cdst[i] = c;
+  }
+  return dst;
+}
+
+void*
+bytememmove(void *vdst, const void *vsrc, int n)
+{
+  char *dst;
+  const char *src;
+
+  dst = vdst;
+  src = vsrc;
+  while(n-- > 0)
+    *dst++ = *src++;
+  return vdst;
+}
+
+int
+bytememcmp(const void *s1, const void *s2, uint n)
+{
+  const char *p1 = s1, *p2 = s2;
+  while (n-- > 0) {
+    if (*p1 != *p2) {
+      return *p1 - *p2;
+    }
+    p1++;
+    p2++;
+  }
+  return 0;
+}
+
+// print bytes per cycle with two decimals.
+void
+report(char *what, char *how, int n, uint64 cycles)
+{
+  uint64 r;
+
+  r = cycles ? (uint64)n * NROUND * 100 / cycles : 0;
+  printf("%s %d %s: %d.%d%d bytes/cycle\n", what, n, how,
+         (int)(r / 100), (int)(r / 10 % 10), (int)(r % 10));
+}
+
+void
+bench(int n)
+{
+  uint64 t;
+  int i;
+
+  t = rdcycle();
+  for(i = 0; i < NROUND; i++)
+    bytememset(dst, i, n);
+  report("memset", "bytes", n, rdcycle() - t);
+  t = rdcycle();
+  for(i = 0; i < NROUND; i++)
+    memset(dst, i, n);
+  report("memset", "words", n, rdcycle() - t);
+
+  t = rdcycle();
+  for(i = 0; i < NROUND; i++)
+    bytememmove(dst, src, n);
+  report("memmove", "bytes", n, rdcycle() - t);
+  t = rdcycle();
+  for(i = 0; i < NROUND; i++)
+    memmove(dst, src, n);
+  report("memmove", "words", n, rdcycle() - t);
+  // equally misaligned: a byte head and tail around words.
+  t = rdcycle();
+  for(i = 0; i < NROUND; i++)
+    memmove(dst + 3, src + 3, n);
+  report("memmove", "words+3", n, rdcycle() - t);
+
+  t = rdcycle();
+  for(i = 0; i < NROUND; i++)
+    if(bytememcmp(dst, src, n) != 0)
+      break;
+  report("memcmp", "bytes", n, rdcycle() - t);
+  t = rdcycle();
+  for(i = 0; i < NROUND; i++)
+    if(memcmp(dst, src, n) != 0)
+      break;
+  report("memcmp", "words", n, rdcycle() - t);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  for(i = 0; i < sizeof(src); i++)
+    src[i] = i;
+  bench(1024);
+  bench(PGSIZE);
+  exit(0);
+}
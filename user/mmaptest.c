@@ -0,0 +1,301 @@
+//
+// tests for mmap() and munmap()
+//
+
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define MAP_FAILED ((char *) -1)
+
+char buf[BSIZE];
+
+void
+err(char *why)
+{
+  printf("mmaptest failure: %s, pid=%d\n", why, getpid());
+  exit(1);
+}
+
+// make a file of one and a half pages: the first page
+// is all 'A', the next half page all 'B'.
+void
+makefile(const char *f)
+{
+  int i, n;
+  int fd;
+
+  unlink(f);
+  fd = open(f, O_WRONLY | O_CREATE);
+  if(fd == -1)
+    err("open");
+  n = PGSIZE/BSIZE;
+  memset(buf, 'A', BSIZE);
+  for(i = 0; i < n; i++)
+    if(write(fd, buf, BSIZE) != BSIZE)
+      err("write 0 makefile");
+  memset(buf, 'B', BSIZE);
+  for(i = 0; i < n/2; i++)
+    if(write(fd, buf, BSIZE) != BSIZE)
+      err("write 1 makefile");
+  if(close(fd) == -1)
+    err("close");
+}
+
+// check that the two pages at p hold what makefile() wrote,
+// with zeroes past the end of the file.
+void
+checkfile(char *p)
+{
+  int i;
+
+  for(i = 0; i < PGSIZE; i++)
+    if(p[i] != 'A')
+      err("wrong content in first page");
+  for(; i < PGSIZE + PGSIZE/2; i++)
+    if(p[i] != 'B')
+      err("wrong content in second page");
+  for(; i < 2*PGSIZE; i++)
+    if(p[i] != 0)
+      err("not zero past end of file");
+}
+
+// check the first n bytes of file f are all c.
+void
+checkbytes(const char *f, int n, char c)
+{
+  int fd, i, m;
+
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open checkbytes");
+  while(n > 0){
+    m = n < sizeof(buf) ? n : sizeof(buf);
+    if(read(fd, buf, m) != m)
+      err("read checkbytes");
+    for(i = 0; i < m; i++)
+      if(buf[i] != c)
+        err("file has wrong content");
+    n -= m;
+  }
+  close(fd);
+}
+
+void
+privatetest(void)
+{
+  const char *f = "mmap.dur";
+  char *p;
+  int fd;
+
+  printf("private: ");
+  makefile(f);
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+
+  // a private mapping may be written even if the file may not.
+  p = mmap(0, 2*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap private");
+  close(fd);
+  checkfile(p);
+  p[0] = 'Z';
+  if(munmap(p, 2*PGSIZE) == -1)
+    err("munmap private");
+  checkbytes(f, PGSIZE, 'A');
+
+  // the mapping is gone.
+  int pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    p[0] = 1;
+    exit(0);
+  }
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus == 0)
+    err("unmapped page still accessible");
+
+  printf("ok\n");
+}
+
+void
+sharedtest(void)
+{
+  const char *f = "mmap.dur";
+  char *p;
+  int fd;
+
+  printf("shared: ");
+  makefile(f);
+
+  // may not write through a shared mapping of a read-only file.
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  p = mmap(0, 2*PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p != MAP_FAILED)
+    err("mmap shared writable of read-only file succeeded");
+  close(fd);
+
+  if((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  p = mmap(0, 2*PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap shared");
+  close(fd);
+  checkfile(p);
+
+  // unmap the first page and keep using the second.
+  memset(p, 'C', PGSIZE);
+  if(munmap(p, PGSIZE) == -1)
+    err("munmap first page");
+  checkbytes(f, PGSIZE, 'C');
+  memset(p + PGSIZE, 'D', PGSIZE/2);
+  // writing past the end of the file must not grow it.
+  p[PGSIZE + PGSIZE/2] = 'E';
+  if(munmap(p + PGSIZE, PGSIZE) == -1)
+    err("munmap second page");
+
+  struct stat st;
+  if(stat(f, &st) == -1)
+    err("stat");
+  if(st.size != PGSIZE + PGSIZE/2)
+    err("file size changed");
+  checkbytes(f, PGSIZE, 'C');
+
+  printf("ok\n");
+}
+
+// read() into a shared mapping writes the file too.
+void
+readtest(void)
+{
+  const char *f = "mmap.dur";
+  char *p;
+  int fd, fds[2];
+
+  printf("read: ");
+  makefile(f);
+  if((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  p = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  close(fd);
+
+  if(pipe(fds) < 0)
+    err("pipe");
+  memset(buf, 'F', 16);
+  if(write(fds[1], buf, 16) != 16)
+    err("write pipe");
+  if(read(fds[0], p + 100, 16) != 16)
+    err("read pipe");
+  close(fds[0]);
+  close(fds[1]);
+  if(munmap(p, PGSIZE) == -1)
+    err("munmap");
+
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  if(read(fd, buf, 200) != 200)
+    err("read");
+  close(fd);
+  if(buf[99] != 'A' || buf[100] != 'F' || buf[115] != 'F' || buf[116] != 'A')
+    err("read() into mapping not written back");
+
+  printf("ok\n");
+}
+
+// an exiting process writes back its shared mappings.
+void
+exittest(void)
+{
+  const char *f = "mmap.dur";
+  char *p;
+  int fd, pid, xstatus;
+
+  printf("exit: ");
+  makefile(f);
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    if((fd = open(f, O_RDWR)) == -1)
+      err("open");
+    p = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED)
+      err("mmap");
+    memset(p, 'G', PGSIZE);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  checkbytes(f, PGSIZE, 'G');
+
+  printf("ok\n");
+}
+
+// anonymous memory, shared or private across fork(),
+// and a hole punched in the middle of a mapping.
+void
+anontest(void)
+{
+  char *s, *q;
+  int pid, xstatus;
+
+  printf("anonymous: ");
+  s = mmap(0, 3*PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  q = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(s == MAP_FAILED || q == MAP_FAILED)
+    err("mmap anonymous");
+  if(s[0] != 0 || q[0] != 0)
+    err("anonymous memory not zero");
+  s[0] = 1;
+  q[0] = 1;
+
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    if(s[0] != 1 || q[0] != 1)
+      err("child does not see parent's memory");
+    s[0] = 2;
+    s[2*PGSIZE] = 2;
+    q[0] = 2;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  if(s[0] != 2 || s[2*PGSIZE] != 2)
+    err("shared memory not shared");
+  if(q[0] != 1)
+    err("private memory not private");
+
+  if(munmap(s + PGSIZE, PGSIZE) == -1)
+    err("munmap middle");
+  if(s[0] != 2 || s[2*PGSIZE] != 2)
+    err("munmap middle lost the rest");
+  if(munmap(s, 3*PGSIZE) == -1 || munmap(q, PGSIZE) == -1)
+    err("munmap");
+
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  privatetest();
+  sharedtest();
+  readtest();
+  exittest();
+  anontest();
+  unlink("mmap.dur");
+  printf("ALL MMAP TESTS PASSED\n");
+  exit(0);
+}
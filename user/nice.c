@@ -0,0 +1,35 @@
+//
+// nice: run a command with its nice value raised by n,
+// or by 10 if n is not given. a negative n lowers it.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int incr, i;
+
+  incr = 10;
+  i = 1;
+  if(argc > 1 && argv[1][0] == '-' && argv[1][1] == 'n'){
+    if(argc < 3){
+      fprintf(2, "usage: nice [-n incr] command [arg ...]\n");
+      exit(1);
+    }
+    if(argv[2][0] == '-')
+      incr = -atoi(argv[2] + 1);
+    else
+      incr = atoi(argv[2]);
+    i = 3;
+  }
+  if(i >= argc){
+    fprintf(2, "usage: nice [-n incr] command [arg ...]\n");
+    exit(1);
+  }
+  nice(incr);
+  exec(argv[i], argv + i);
+  fprintf(2, "nice: exec %s failed\n", argv[i]);
+  exit(1);
+}
@@ -0,0 +1,155 @@
+//
+// procbench: time fork(), exit() and wait(), and open() and
+// close(), with more and more processes and open files in
+// the system. The process, file and inode tables grow as
+// they are needed, and nothing that finds an entry in them
+// should slow down as they do.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NFORK 500     // fork/exit/wait rounds per measurement
+#define NOPEN 2000    // open/close rounds per measurement
+#define MAXIDLE 2000  // most idle processes
+#define MAXFILES 400  // most files held open
+
+int idlefds[2];
+
+void
+report(char *what, int load, int n, int ticks)
+{
+  printf("%s with %d around: %d in %d ticks\n", what, load, n, ticks);
+}
+
+// make idle children until there are n. each waits for
+// the pipe to close. returns how many there are.
+int
+addidle(int have, int n)
+{
+  char c;
+  int pid;
+
+  for(; have < n; have++){
+    pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0){
+      close(idlefds[1]);
+      read(idlefds[0], &c, 1);
+      exit(0);
+    }
+  }
+  return have;
+}
+
+void
+forkbench(void)
+{
+  static int loads[] = { 0, 100, 1000, MAXIDLE };
+  int i, j, n, pid, t0;
+
+  if(pipe(idlefds) < 0){
+    fprintf(2, "procbench: pipe failed\n");
+    exit(1);
+  }
+  n = 0;
+  for(i = 0; i < sizeof(loads)/sizeof(loads[0]); i++){
+    n = addidle(n, loads[i]);
+    t0 = uptime();
+    for(j = 0; j < NFORK; j++){
+      pid = fork();
+      if(pid < 0){
+        fprintf(2, "procbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0)
+        exit(0);
+      if(wait(0) != pid){
+        fprintf(2, "procbench: wait failed\n");
+        exit(1);
+      }
+    }
+    report("fork+exit+wait", n, NFORK, uptime() - t0);
+    if(n < loads[i])
+      break;
+  }
+
+  // let the idle children go.
+  close(idlefds[0]);
+  close(idlefds[1]);
+  while(wait(0) >= 0)
+    ;
+}
+
+void
+name(char *buf, int i)
+{
+  buf[0] = 'p';
+  buf[1] = 'b';
+  buf[2] = '0' + i / 100 % 10;
+  buf[3] = '0' + i / 10 % 10;
+  buf[4] = '0' + i % 10;
+  buf[5] = 0;
+}
+
+void
+filebench(void)
+{
+  static int loads[] = { 0, 10, 100, MAXFILES };
+  char buf[8];
+  int i, j, n, fd, t0;
+
+  if(mkdir("pbdir") < 0 || chdir("pbdir") < 0){
+    fprintf(2, "procbench: cannot make pbdir\n");
+    exit(1);
+  }
+  if((fd = open("target", O_CREATE | O_RDWR)) < 0){
+    fprintf(2, "procbench: cannot create target\n");
+    exit(1);
+  }
+  close(fd);
+
+  // hold open more and more distinct files, each with
+  // its own file and inode, and time opening another.
+  n = 0;
+  for(i = 0; i < sizeof(loads)/sizeof(loads[0]); i++){
+    for(; n < loads[i]; n++){
+      name(buf, n);
+      if(open(buf, O_CREATE | O_RDWR) < 0){
+        fprintf(2, "procbench: cannot create %s\n", buf);
+        exit(1);
+      }
+    }
+    t0 = uptime();
+    for(j = 0; j < NOPEN; j++){
+      if((fd = open("target", O_RDONLY)) < 0){
+        fprintf(2, "procbench: open failed\n");
+        exit(1);
+      }
+      close(fd);
+    }
+    report("open+close", n, NOPEN, uptime() - t0);
+  }
+
+  // descriptors 0..2 are the console; the rest are ours.
+  for(fd = 3; fd < 3 + n; fd++)
+    close(fd);
+  for(i = 0; i < n; i++){
+    name(buf, i);
+    unlink(buf);
+  }
+  unlink("target");
+  chdir("..");
+  unlink("pbdir");
+}
+
+int
+main(int argc, char *argv[])
+{
+  forkbench();
+  filebench();
+  exit(0);
+}
@@ -0,0 +1,42 @@
+//
+// ps: list processes, with their scheduling state,
+// nice value and CPU time.
+//
+
+#include "kernel/types.h"
+#include "kernel/procinfo.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct procinfo *procs, *pi;
+  int n, max;
+
+  // the process table has no fixed size; grow the buffer
+  // until getprocs() leaves room to spare.
+  procs = 0;
+  for(max = 64; ; max *= 2){
+    if(procs)
+      free(procs);
+    if((procs = malloc(max * sizeof(*procs))) == 0){
+      fprintf(2, "ps: out of memory\n");
+      exit(1);
+    }
+    if((n = getprocs(procs, max)) < 0){
+      fprintf(2, "ps: getprocs failed\n");
+      exit(1);
+    }
+    if(n < max)
+      break;
+  }
+  printf("PID\tPPID\tS CPU\tNICE\tTIME\tSIZE\tNAME\n");
+  for(pi = procs; pi < &procs[n]; pi++){
+    printf("%d\t%d\t%c %d\t%d\t%d.%d%d\t%dK\t%s\n",
+           pi->pid, pi->ppid, pi->state, pi->cpu, pi->nice,
+           (int)(pi->cputime / 1000000),
+           (int)(pi->cputime / 100000 % 10), (int)(pi->cputime / 10000 % 10),
+           (int)(pi->sz / 1024), pi->name);
+  }
+  exit(0);
+}
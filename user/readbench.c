@@ -0,0 +1,90 @@
+//
+// readbench: 1, 2, 4 and 8 processes at once each read its
+// own small file over and over. The files stay in the buffer
+// cache, so the time goes to finding blocks there; if that
+// scales, the total rate grows with the number of readers,
+// up to the number of CPUs.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define MAXPROC 8
+#define FILESZ (2*BSIZE)
+#define NREAD 2000      // reads of the whole file per process
+
+char buf[FILESZ];
+
+void
+name(char *f, int i)
+{
+  f[0] = 'r';
+  f[1] = 'b';
+  f[2] = '0' + i;
+  f[3] = 0;
+}
+
+void
+reader(int i)
+{
+  char f[4];
+  int fd, n;
+
+  name(f, i);
+  for(n = 0; n < NREAD; n++){
+    if((fd = open(f, O_RDONLY)) < 0 || read(fd, buf, FILESZ) != FILESZ){
+      fprintf(2, "readbench: read %s failed\n", f);
+      exit(1);
+    }
+    close(fd);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char f[4];
+  int i, n, fd, t0, t, xstatus;
+
+  for(i = 0; i < MAXPROC; i++){
+    name(f, i);
+    if((fd = open(f, O_CREATE | O_RDWR)) < 0 || write(fd, buf, FILESZ) != FILESZ){
+      fprintf(2, "readbench: cannot create %s\n", f);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  for(n = 1; n <= MAXPROC; n *= 2){
+    t0 = uptime();
+    for(i = 0; i < n; i++){
+      int pid = fork();
+      if(pid < 0){
+        fprintf(2, "readbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0)
+        reader(i);
+    }
+    for(i = 0; i < n; i++){
+      wait(&xstatus);
+      if(xstatus != 0)
+        exit(1);
+    }
+    t = uptime() - t0;
+    printf("%d readers: %d KB in %d ticks", n, n * NREAD * (FILESZ / 1024), t);
+    if(t > 0)
+      printf(", %d KB/tick", n * NREAD * (FILESZ / 1024) / t);
+    printf("\n");
+  }
+
+  for(i = 0; i < MAXPROC; i++){
+    name(f, i);
+    unlink(f);
+  }
+  exit(0);
+}
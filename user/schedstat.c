@@ -0,0 +1,97 @@
+//
+// schedstat: print each CPU's scheduling histograms: how
+// long processes waited to run once RUNNABLE, how long they
+// ran before giving up the CPU, and how long the switch back
+// to the scheduler took. With a command, run it and print
+// only what happened meanwhile.
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/schedstat.h"
+#include "user/user.h"
+
+enum { WAIT, SLICE, SWTCH };
+
+struct schedstat before[NCPU], after[NCPU];
+
+uint64*
+hist(struct schedstat *st, int which)
+{
+  switch(which){
+  case WAIT:
+    return st->wait;
+  case SLICE:
+    return st->slice;
+  }
+  return st->swtch;
+}
+
+void
+printhist(char *what, int which, int n)
+{
+  uint64 *h;
+  int i, c, any;
+
+  printf("%s:\nusec", what);
+  for(c = 0; c < n; c++)
+    printf("\tcpu%d", after[c].cpu);
+  printf("\n");
+  for(i = 0; i < NSCHEDHIST; i++){
+    any = 0;
+    for(c = 0; c < n; c++)
+      if(hist(&after[c], which)[i] != 0)
+        any = 1;
+    if(!any)
+      continue;
+    if(i == 0)
+      printf("<2");
+    else if(i == NSCHEDHIST-1)
+      printf(">=%d", 1 << i);
+    else
+      printf("%d-%d", 1 << i, 1 << (i+1));
+    for(c = 0; c < n; c++){
+      h = hist(&after[c], which);
+      printf("\t%d", (int)h[i]);
+    }
+    printf("\n");
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, c, i, which;
+
+  memset(before, 0, sizeof(before));
+  if(argc > 1){
+    if(schedstat(before, NCPU) < 0){
+      fprintf(2, "schedstat: schedstat failed\n");
+      exit(1);
+    }
+    if(spawn(argv[1], argv + 1, 0) < 0){
+      fprintf(2, "schedstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  if((n = schedstat(after, NCPU)) < 0){
+    fprintf(2, "schedstat: schedstat failed\n");
+    exit(1);
+  }
+  for(c = 0; c < n; c++){
+    after[c].nmigrate -= before[c].nmigrate;
+    for(which = WAIT; which <= SWTCH; which++)
+      for(i = 0; i < NSCHEDHIST; i++)
+        hist(&after[c], which)[i] -= hist(&before[c], which)[i];
+  }
+
+  printhist("wait to run", WAIT, n);
+  printhist("time slice", SLICE, n);
+  printhist("switch to scheduler", SWTCH, n);
+  printf("migrations:");
+  for(c = 0; c < n; c++)
+    printf("\t%d", after[c].nmigrate);
+  printf("\n");
+  exit(0);
+}
@@ -0,0 +1,88 @@
+//
+// spawnbench: how many commands a second can be started
+// and waited for, with fork() and exec() as sh used to, and
+// with spawn(), which makes no copy of the parent. fork()'s
+// cost grows with the parent's memory, so both are timed
+// again once this process has grown.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define N 200           // commands started per measurement
+#define GROW (4*1024*1024)
+
+char *args[] = { "spawnbench", "-c", 0 };
+
+void
+report(char *what, int ticks)
+{
+  printf("%s: %d in %d ticks", what, N, ticks);
+  if(ticks > 0)
+    printf(", %d/second", N * TICKHZ / ticks);
+  printf("\n");
+}
+
+void
+forkexec(char *what)
+{
+  int i, pid, t0;
+
+  t0 = uptime();
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "spawnbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(args[0], args);
+      fprintf(2, "spawnbench: exec failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  report(what, uptime() - t0);
+}
+
+void
+spawns(char *what)
+{
+  int i, t0;
+
+  t0 = uptime();
+  for(i = 0; i < N; i++){
+    if(spawn(args[0], args, 0) < 0){
+      fprintf(2, "spawnbench: spawn failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  report(what, uptime() - t0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *p;
+  int i;
+
+  // the command being started.
+  if(argc > 1 && strcmp(argv[1], "-c") == 0)
+    exit(0);
+
+  forkexec("fork+exec");
+  spawns("spawn");
+
+  if((p = sbrk(GROW)) == (char*)-1){
+    fprintf(2, "spawnbench: sbrk failed\n");
+    exit(1);
+  }
+  for(i = 0; i < GROW; i += 4096)
+    p[i] = 1;
+  forkexec("fork+exec, 4MB parent");
+  spawns("spawn, 4MB parent");
+  exit(0);
+}
@@ -0,0 +1,44 @@
+// stats: print kernel counters from the statistics device.
+// stats with an argument prints only the lines that
+// start with that prefix, e.g. "stats kalloc".
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+char buf[512];
+char line[256];
+
+int
+main(int argc, char *argv[])
+{
+  int fd, n, i, len;
+  char *prefix;
+
+  prefix = argc > 1 ? argv[1] : 0;
+  if((fd = open("statistics", O_RDONLY)) < 0){
+    fprintf(2, "stats: cannot open statistics\n");
+    exit(1);
+  }
+
+  len = 0;
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    for(i = 0; i < n; i++){
+      if(len < sizeof(line) - 1)
+        line[len++] = buf[i];
+      if(buf[i] != '\n')
+        continue;
+      line[len] = 0;
+      if(prefix == 0 || memcmp(line, prefix, strlen(prefix)) == 0)
+        printf("%s", line);
+      len = 0;
+    }
+  }
+  close(fd);
+  if(n < 0){
+    fprintf(2, "stats: read error\n");
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,88 @@
+//
+// taskset: run a command only on the given CPUs, or show
+// or change the CPUs process pid may run on. CPUs are a
+// comma-separated list of numbers, such as 0,2.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+void
+usage(void)
+{
+  fprintf(2, "usage: taskset cpus command [arg ...]\n"
+             "       taskset -p [cpus] pid\n");
+  exit(1);
+}
+
+// turn a list of CPUs into a mask, bit i for CPU i.
+int
+parsecpus(char *s)
+{
+  int mask, n;
+
+  mask = 0;
+  while(*s){
+    if(*s < '0' || *s > '9')
+      usage();
+    n = 0;
+    while(*s >= '0' && *s <= '9')
+      n = n * 10 + *s++ - '0';
+    if(n >= 32)
+      usage();
+    mask |= 1 << n;
+    if(*s == ',')
+      s++;
+  }
+  if(mask == 0)
+    usage();
+  return mask;
+}
+
+void
+printcpus(int pid, int mask)
+{
+  int i, sep;
+
+  printf("pid %d: cpus ", pid);
+  sep = 0;
+  for(i = 0; i < 32; i++){
+    if(mask & (1 << i)){
+      printf(sep ? ",%d" : "%d", i);
+      sep = 1;
+    }
+  }
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int pid, mask;
+
+  if(argc >= 3 && strcmp(argv[1], "-p") == 0){
+    pid = atoi(argv[argc - 1]);
+    if(argc == 4 && setaffinity(pid, parsecpus(argv[2])) < 0){
+      fprintf(2, "taskset: cannot set cpus of pid %d\n", pid);
+      exit(1);
+    } else if(argc > 4){
+      usage();
+    }
+    if((mask = getaffinity(pid)) < 0){
+      fprintf(2, "taskset: no pid %d\n", pid);
+      exit(1);
+    }
+    printcpus(pid, mask);
+    exit(0);
+  }
+
+  if(argc < 3)
+    usage();
+  if(setaffinity(0, parsecpus(argv[1])) < 0){
+    fprintf(2, "taskset: no such cpus: %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "taskset: exec %s failed\n", argv[2]);
+  exit(1);
+}
@@ -0,0 +1,451 @@
+//
+// tests for clone() and join(): threads share memory,
+// the heap, mmap()ed areas and file descriptors; and for
+// the futex()-based mutexes and condition variables.
+//
+
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define MAP_FAILED ((char *) -1)
+#define NT 4            // threads per test
+#define NINC 10000      // increments per thread
+#define STACKSZ PGSIZE
+
+volatile int counter;
+volatile char *shared;
+volatile int fd;
+char *stacks[NT];
+
+void
+err(char *why)
+{
+  printf("threadtest failure: %s, pid=%d\n", why, getpid());
+  exit(1);
+}
+
+// start NT threads running fn, each with its number as
+// argument.
+void
+start(void (*fn)(void*))
+{
+  int i;
+
+  for(i = 0; i < NT; i++){
+    if(stacks[i] == 0 && (stacks[i] = malloc(STACKSZ)) == 0)
+      err("malloc");
+    if(clone(fn, (void*)(uint64)i, stacks[i] + STACKSZ) < 0)
+      err("clone");
+  }
+}
+
+// join all NT threads, checking that each exited with
+// its number.
+void
+joinall(void)
+{
+  int i, xstatus, seen;
+
+  seen = 0;
+  for(i = 0; i < NT; i++){
+    if(join(0, &xstatus) < 0)
+      err("join");
+    if(xstatus < 0 || xstatus >= NT || (seen & (1 << xstatus)))
+      err("wrong exit status");
+    seen |= 1 << xstatus;
+  }
+  if(join(0, 0) != -1)
+    err("join with no threads left");
+}
+
+void
+incthread(void *arg)
+{
+  int i;
+
+  for(i = 0; i < NINC; i++)
+    __sync_fetch_and_add(&counter, 1);
+  exit((int)(uint64)arg);
+}
+
+// all threads see the same memory.
+void
+countertest(void)
+{
+  printf("counter: ");
+  counter = 0;
+  start(incthread);
+  joinall();
+  if(counter != NT * NINC)
+    err("lost increments");
+  // wait() does not see threads.
+  if(wait(0) != -1)
+    err("wait() returned a thread");
+  printf("ok\n");
+}
+
+void
+sbrkthread(void *arg)
+{
+  int i = (int)(uint64)arg;
+  char *p;
+
+  if((p = sbrk(PGSIZE)) == (char*)-1)
+    err("sbrk in thread");
+  p[0] = 'a' + i;
+  shared[i] = 0;
+  // hand the new page to the main thread.
+  *(char**)&stacks[i][0] = p;
+  exit(i);
+}
+
+// memory one thread adds with sbrk() is there for the
+// others, and memory the main thread takes away is gone
+// for all of them.
+void
+sbrktest(void)
+{
+  char *p;
+  int i, pid, xstatus;
+
+  printf("sbrk: ");
+  shared = sbrk(PGSIZE);
+  memset((char*)shared, 1, NT);
+  start(sbrkthread);
+  joinall();
+  for(i = 0; i < NT; i++){
+    p = *(char**)&stacks[i][0];
+    if(shared[i] != 0 || p[0] != 'a' + i)
+      err("thread's memory not shared");
+  }
+
+  // shrink the heap while a thread is running, then fault.
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    counter = 0;
+    start(incthread);
+    p = sbrk(0);
+    sbrk(-(NT+1) * PGSIZE);
+    joinall();
+    p[-1] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1)
+    err("memory freed by sbrk() still accessible");
+  printf("ok\n");
+}
+
+void
+mmapthread(void *arg)
+{
+  int i = (int)(uint64)arg;
+
+  if(shared[i*PGSIZE] != 'm')
+    err("thread does not see mapping");
+  shared[i*PGSIZE] = 't';
+  exit(i);
+}
+
+// an area one thread maps is there for the others, and
+// gone for all of them once unmapped.
+void
+mmaptest(void)
+{
+  char *p;
+  int i, pid, xstatus;
+
+  printf("mmap: ");
+  p = mmap(0, NT*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  for(i = 0; i < NT; i++)
+    p[i*PGSIZE] = 'm';
+  shared = p;
+  start(mmapthread);
+  joinall();
+  for(i = 0; i < NT; i++)
+    if(p[i*PGSIZE] != 't')
+      err("thread's write not seen");
+  if(munmap(p, NT*PGSIZE) < 0)
+    err("munmap");
+
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    p = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+      err("mmap");
+    p[0] = 'm';
+    shared = p;
+    counter = 0;
+    start(incthread);
+    munmap(p, PGSIZE);
+    joinall();
+    p[0] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1)
+    err("unmapped page still accessible");
+  printf("ok\n");
+}
+
+char *heapfresh, *mapfresh;
+int pfds[2];
+volatile int go;
+
+void
+faultthread(void *arg)
+{
+  int i = (int)(uint64)arg;
+
+  while(go == 0)
+    ;
+  if(heapfresh[0] != 0 || mapfresh[0] != 0)
+    err("fresh page not zero");
+  if(write(pfds[1], heapfresh + PGSIZE, 1) != 1)
+    err("write from fresh page");
+  exit(i);
+}
+
+// threads that fault on the same fresh heap and mmap()ed
+// pages at once all see them, whichever fills them in, and
+// so does a system call copying from a fresh page.
+void
+faulttest(void)
+{
+  char buf[NT];
+  int round;
+
+  printf("faults on the same page: ");
+  if(pipe(pfds) < 0)
+    err("pipe");
+  for(round = 0; round < 10; round++){
+    if((heapfresh = sbrk(2*PGSIZE)) == (char*)-1)
+      err("sbrk");
+    mapfresh = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mapfresh == MAP_FAILED)
+      err("mmap");
+    go = 0;
+    start(faultthread);
+    go = 1;
+    joinall();
+    if(read(pfds[0], buf, NT) != NT)
+      err("writes lost");
+    munmap(mapfresh, PGSIZE);
+  }
+  close(pfds[0]);
+  close(pfds[1]);
+  printf("ok\n");
+}
+
+void
+filethread(void *arg)
+{
+  int i = (int)(uint64)arg;
+  char c = 'a' + i;
+
+  if(i == 0){
+    if((fd = open("thread.tmp", O_CREATE | O_RDWR)) < 0)
+      err("open in thread");
+  } else {
+    while(fd < 0)
+      ;
+  }
+  if(write(fd, &c, 1) != 1)
+    err("write in thread");
+  exit(i);
+}
+
+// threads share open files.
+void
+filetest(void)
+{
+  char buf[NT];
+  int i, n;
+
+  printf("files: ");
+  fd = -1;
+  start(filethread);
+  joinall();
+  if(fd < 0)
+    err("thread's file not opened");
+  if(close(fd) < 0)
+    err("thread's descriptor not shared");
+  if((fd = open("thread.tmp", O_RDONLY)) < 0)
+    err("open");
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  unlink("thread.tmp");
+  if(n != NT)
+    err("writes lost");
+  for(i = 0; i < NT; i++)
+    if(buf[i] < 'a' || buf[i] >= 'a' + NT)
+      err("wrong file content");
+  printf("ok\n");
+}
+
+void
+execthread(void *arg)
+{
+  int i = (int)(uint64)arg;
+
+  while(counter == 0)
+    ;
+  exit(i);
+}
+
+// a thread may not exec() while others are running, and a
+// process may fork() while threads are running.
+void
+exectest(void)
+{
+  char *argv[] = { "echo", "oops", 0 };
+  int pid, xstatus;
+
+  printf("fork and exec: ");
+  counter = 0;
+  start(execthread);
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    // the child has no threads.
+    if(join(0, 0) != -1)
+      err("child has parent's threads");
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  if(exec("echo", argv) != -1)
+    err("exec with threads running");
+  counter = 1;
+  joinall();
+  printf("ok\n");
+}
+
+struct mutex mu;
+struct cond nonempty, nonfull;
+volatile int nitems, plain;
+
+void
+mutexthread(void *arg)
+{
+  int i;
+
+  for(i = 0; i < NINC; i++){
+    mutexlock(&mu);
+    plain = plain + 1;
+    mutexunlock(&mu);
+  }
+  exit((int)(uint64)arg);
+}
+
+// producers put NINC items each into a one-slot buffer,
+// and consumers take them out.
+void
+condthread(void *arg)
+{
+  int i = (int)(uint64)arg;
+  int n;
+
+  for(n = 0; n < NINC; n++){
+    mutexlock(&mu);
+    if(i % 2 == 0){
+      while(nitems == 1)
+        condwait(&nonfull, &mu);
+      nitems = 1;
+      plain++;
+      condsignal(&nonempty);
+    } else {
+      while(nitems == 0)
+        condwait(&nonempty, &mu);
+      nitems = 0;
+      condsignal(&nonfull);
+    }
+    mutexunlock(&mu);
+  }
+  exit(i);
+}
+
+// a mutex keeps a non-atomic counter right, and condition
+// variables hand items from producers to consumers.
+void
+mutextest(void)
+{
+  printf("mutex: ");
+  mutexinit(&mu);
+  plain = 0;
+  start(mutexthread);
+  joinall();
+  if(plain != NT * NINC)
+    err("mutex lost increments");
+  printf("ok\n");
+
+  printf("condition variables: ");
+  condinit(&nonempty);
+  condinit(&nonfull);
+  nitems = 0;
+  plain = 0;
+  start(condthread);
+  joinall();
+  if(plain != (NT/2) * NINC || nitems != 0)
+    err("items lost");
+  printf("ok\n");
+}
+
+// a futex in MAP_SHARED memory works between processes.
+void
+futextest(void)
+{
+  volatile int *w;
+  int pid, xstatus;
+
+  printf("futex between processes: ");
+  w = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(w == (int*)MAP_FAILED)
+    err("mmap");
+  *w = 0;
+  if(futex(w, FUTEX_WAIT, 1) != -1)
+    err("futex waited for the wrong value");
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    while(*w == 0)
+      futex(w, FUTEX_WAIT, 0);
+    exit(0);
+  }
+  sleep(1);
+  *w = 1;
+  futex(w, FUTEX_WAKE, 1);
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("waiter not woken");
+  munmap((void*)w, PGSIZE);
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  countertest();
+  sbrktest();
+  mmaptest();
+  faulttest();
+  filetest();
+  exectest();
+  mutextest();
+  futextest();
+  printf("ALL THREAD TESTS PASSED\n");
+  exit(0);
+}
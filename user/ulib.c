@@ -3,6 +3,10 @@
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
+// memset(), memmove() and memcmp() work a word at a time
+// where their pointers' alignment allows, as in the kernel.
+#define WORDALIGNED(p) (((uint64)(p) & 7) == 0)
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -36,10 +40,28 @@ void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w, *wdst;
+
+  while(n > 0 && !WORDALIGNED(cdst)){
+    *cdst++ = c;
+    n--;
   }
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+  wdst = (uint64 *) cdst;
+  for(; n >= 32; n -= 32, wdst += 4){
+    wdst[0] = w;
+    wdst[1] = w;
+    wdst[2] = w;
+    wdst[3] = w;
+  }
+  for(; n >= 8; n -= 8)
+    *wdst++ = w;
+  cdst = (char *) wdst;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -104,11 +126,32 @@ memmove(void *vdst, const void *vsrc, int n)
   dst = vdst;
   src = vsrc;
   if (src > dst) {
+    if(WORDALIGNED((uint64)src ^ (uint64)dst)){
+      for(; n > 0 && !WORDALIGNED(dst); n--)
+        *dst++ = *src++;
+      for(; n >= 32; n -= 32, dst += 32, src += 32){
+        ((uint64*)dst)[0] = ((uint64*)src)[0];
+        ((uint64*)dst)[1] = ((uint64*)src)[1];
+        ((uint64*)dst)[2] = ((uint64*)src)[2];
+        ((uint64*)dst)[3] = ((uint64*)src)[3];
+      }
+      for(; n >= 8; n -= 8, dst += 8, src += 8)
+        *(uint64*)dst = *(uint64*)src;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(WORDALIGNED((uint64)src ^ (uint64)dst)){
+      for(; n > 0 && !WORDALIGNED(dst); n--)
+        *--dst = *--src;
+      for(; n >= 8; n -= 8){
+        dst -= 8;
+        src -= 8;
+        *(uint64*)dst = *(uint64*)src;
+      }
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -119,6 +162,13 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+  if(WORDALIGNED((uint64)p1 ^ (uint64)p2)){
+    for(; n > 0 && !WORDALIGNED(p1); n--, p1++, p2++)
+      if(*p1 != *p2)
+        return *p1 - *p2;
+    while(n >= 8 && *(uint64*)p1 == *(uint64*)p2)
+      p1 += 8, p2 += 8, n -= 8;
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -134,3 +184,84 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// Times mutexlock() tries for a free lock before sleeping
+// in futex(): long enough to outlast a short critical
+// section on another CPU.
+#define MUTEXSPIN 100
+
+void
+mutexinit(struct mutex *m)
+{
+  m->v = 0;
+}
+
+// m->v is 0 when m is free and 1 when it is held; 2 means
+// someone may be asleep waiting for it, so that mutexunlock()
+// needs to call futex() only then.
+void
+mutexlock(struct mutex *m)
+{
+  int i;
+
+  for(i = 0; i < MUTEXSPIN; i++){
+    if(m->v == 0 && __sync_bool_compare_and_swap(&m->v, 0, 1))
+      return;
+  }
+  while(__sync_lock_test_and_set(&m->v, 2) != 0)
+    futex(&m->v, FUTEX_WAIT, 2);
+}
+
+void
+mutexunlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->v, 1) != 1){
+    __sync_lock_release(&m->v);
+    futex(&m->v, FUTEX_WAKE, 1);
+  }
+}
+
+void
+condinit(struct cond *c)
+{
+  c->seq = 0;
+  c->nwait = 0;
+}
+
+// Release m and wait for a condsignal() or condbroadcast(),
+// then take m again. Callers must hold m, and check their
+// condition again, since a wakeup may be spurious.
+void
+condwait(struct cond *c, struct mutex *m)
+{
+  int seq;
+
+  __sync_fetch_and_add(&c->nwait, 1);
+  seq = c->seq;
+  mutexunlock(m);
+  futex(&c->seq, FUTEX_WAIT, seq);
+  __sync_fetch_and_sub(&c->nwait, 1);
+  // others may be asleep on m too, so unlocking it must
+  // wake one of them.
+  while(__sync_lock_test_and_set(&m->v, 2) != 0)
+    futex(&m->v, FUTEX_WAIT, 2);
+}
+
+// Wake one thread in condwait() on c. Only enters the
+// kernel if there is one. Callers should hold the mutex
+// the waiters use.
+void
+condsignal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  if(c->nwait > 0)
+    futex(&c->seq, FUTEX_WAKE, 1);
+}
+
+void
+condbroadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  if(c->nwait > 0)
+    futex(&c->seq, FUTEX_WAKE, c->nwait);
+}
@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct procinfo;
+struct schedstat;
 
 // system calls
 int fork(void);
@@ -23,6 +25,17 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int nice(int);
+int getprocs(struct procinfo*, int);
+int clone(void(*)(void*), void*, void*);
+int join(int, int*);
+int futex(volatile int*, int, int);
+int setaffinity(int, uint);
+int getaffinity(int);
+int spawn(char*, char**, int*);
+int schedstat(struct schedstat*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,3 +53,19 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+
+// ulib.c: locks for threads, and for processes sharing memory
+struct mutex {
+  volatile int v;       // 0 unlocked, 1 locked, 2 locked and waited for
+};
+struct cond {
+  volatile int seq;     // bumped by each signal
+  volatile int nwait;   // threads in condwait()
+};
+void mutexinit(struct mutex*);
+void mutexlock(struct mutex*);
+void mutexunlock(struct mutex*);
+void condinit(struct cond*);
+void condwait(struct cond*, struct mutex*);
+void condsignal(struct cond*);
+void condbroadcast(struct cond*);
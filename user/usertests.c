@@ -7,6 +7,8 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/procinfo.h"
+#include "kernel/schedstat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -680,6 +682,56 @@ exectest(char *s)
 
 }
 
+// spawn() starts a program with the descriptors it is
+// given, and fails without making a child if it cannot.
+void
+spawntest(char *s)
+{
+  char *echoargv[] = { "echo", "OK", 0 };
+  char buf[3];
+  int fd, fds[NSPAWNFD], pid, xstatus;
+
+  unlink("echo-ok");
+  fd = open("echo-ok", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  fds[0] = 0;
+  fds[1] = fd;
+  fds[2] = -1;
+  if((pid = spawn("echo", echoargv, fds)) < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+  fd = open("echo-ok", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 2) != 2 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("echo-ok");
+
+  if(spawn("nosuchprogram", echoargv, 0) != -1){
+    printf("%s: spawn of missing program succeeded\n", s);
+    exit(1);
+  }
+  fds[1] = 100;
+  if(spawn("echo", echoargv, fds) != -1){
+    printf("%s: spawn with bad descriptor succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: failed spawn left a child\n", s);
+    exit(1);
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -1918,7 +1970,7 @@ iref(char *s)
 void
 forktest(char *s)
 {
-  enum{ N = 1000 };
+  enum{ N = 5000 };  // more than NPROC
   int n, pid;
 
   for(n=0; n<N; n++){
@@ -1935,7 +1987,7 @@ forktest(char *s)
   }
 
   if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
+    printf("%s: fork claimed to work %d times!\n", s, N);
     exit(1);
   }
 
@@ -2379,6 +2431,43 @@ pgbug(char *s)
   exit(0);
 }
 
+// a store to the program's text must kill the process,
+// now that text is mapped read-only and shared.
+void
+textwrite(char *s)
+{
+  int pid;
+  int xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    volatile int *addr = (int *) 0;
+    *addr = 10;
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: write to text did not fault\n", s);
+    exit(1);
+  }
+
+  // nor may the kernel write there on the program's behalf.
+  int fd = open("README", 0);
+  if(fd < 0){
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  if(read(fd, (char *) 0, 10) != -1){
+    printf("%s: read into text succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
 // regression test. does the kernel panic if a process sbrk()s its
 // size to be less than a page, or zero, or reduces the break by an
 // amount too small to cause a page to be freed?
@@ -2526,6 +2615,220 @@ execout(char *s)
   exit(0);
 }
 
+// nice() stays within NICEMIN..NICEMAX, is inherited by
+// fork(), and shows up in getprocs().
+void
+nicetest(char *s)
+{
+  static struct procinfo procs[64];
+  int i, n, pid, xstatus;
+
+  if(nice(1000) != NICEMAX || nice(-1000) != NICEMIN){
+    printf("%s: nice not clamped\n", s);
+    exit(1);
+  }
+  if(nice(-NICEMIN + 3) != 3){
+    printf("%s: nice wrong\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(nice(0) != 3)
+      exit(1);
+    n = getprocs(procs, 64);
+    for(i = 0; i < n; i++)
+      if(procs[i].pid == getpid())
+        exit(procs[i].nice == 3 && procs[i].state == 'R' ? 0 : 1);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child has wrong nice or procinfo\n", s);
+    exit(1);
+  }
+  exit(0);
+}
+
+// the CPU the caller is running on, as getprocs() tells it.
+int
+whichcpu(void)
+{
+  static struct procinfo procs[64];
+  int i, n, pid;
+
+  pid = getpid();
+  n = getprocs(procs, 64);
+  for(i = 0; i < n; i++)
+    if(procs[i].pid == pid)
+      return procs[i].cpu;
+  return -1;
+}
+
+// setaffinity() keeps a process on the CPUs it names, is
+// inherited by fork(), and refuses masks of no CPU.
+void
+affinitytest(char *s)
+{
+  int all, mask, i, j, pid, xstatus;
+
+  all = getaffinity(0);
+  if(all <= 0 || (all & 1) == 0){
+    printf("%s: getaffinity %d\n", s, all);
+    exit(1);
+  }
+  if(setaffinity(0, 0) != -1 || getaffinity(-1) != -1){
+    printf("%s: bad mask or pid accepted\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < 2; i++){
+    if((all & (1 << i)) == 0)
+      break;
+    if(setaffinity(0, 1 << i) != 0 || getaffinity(0) != 1 << i){
+      printf("%s: setaffinity to cpu %d failed\n", s, i);
+      exit(1);
+    }
+    // run for a while; we should never be seen elsewhere.
+    for(j = 0; j < 20; j++){
+      if(whichcpu() != i){
+        printf("%s: running on cpu %d, not %d\n", s, whichcpu(), i);
+        exit(1);
+      }
+      sleep(j % 2);
+    }
+  }
+
+  mask = getaffinity(0);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(getaffinity(0) == mask ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child did not inherit affinity\n", s);
+    exit(1);
+  }
+  setaffinity(0, all);
+}
+
+// schedstat() counts this process's trips through the
+// scheduler.
+void
+schedstattest(char *s)
+{
+  static struct schedstat st0[NCPU], st1[NCPU];
+  uint64 n0, n1;
+  int n, c, i;
+
+  if((n = schedstat(st0, NCPU)) <= 0){
+    printf("%s: schedstat failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 10; i++)
+    sleep(1);
+  if(schedstat(st1, NCPU) != n){
+    printf("%s: schedstat changed its mind\n", s);
+    exit(1);
+  }
+  n0 = n1 = 0;
+  for(c = 0; c < n; c++){
+    for(i = 0; i < NSCHEDHIST; i++){
+      n0 += st0[c].wait[i];
+      n1 += st1[c].wait[i];
+    }
+  }
+  if(n1 < n0 + 10){
+    printf("%s: %d runs counted, not 10\n", s, (int)(n1 - n0));
+    exit(1);
+  }
+}
+
+// more children than the old 64-entry process table held,
+// each killed by pid and reaped by wait().
+void
+manychildren(char *s)
+{
+  enum { N = 100 };
+  int pids[N], i, n, xstatus;
+
+  for(n = 0; n < N; n++){
+    pids[n] = fork();
+    if(pids[n] < 0)
+      break;
+    if(pids[n] == 0){
+      for(;;)
+        sleep(1000);
+    }
+  }
+  if(n < N){
+    printf("%s: only %d children\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(kill(pids[i]) < 0){
+      printf("%s: kill %d failed\n", s, pids[i]);
+      exit(1);
+    }
+  }
+  for(i = 0; i < n; i++){
+    if(wait(&xstatus) < 0 || xstatus != -1){
+      printf("%s: wait failed\n", s);
+      exit(1);
+    }
+  }
+  if(wait(0) != -1 || kill(pids[0]) != -1){
+    printf("%s: child still there\n", s);
+    exit(1);
+  }
+}
+
+// more open files than the initial 16-entry descriptor
+// table holds, inherited by a child.
+void
+manyfds(char *s)
+{
+  enum { N = 100 };
+  int fds[N], i, pid, xstatus;
+
+  for(i = 0; i < N; i++){
+    if((fds[i] = open("README", O_RDONLY)) < 0){
+      printf("%s: open %d failed\n", s, i);
+      exit(1);
+    }
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    char c;
+    for(i = 0; i < N; i++)
+      if(read(fds[i], &c, 1) != 1 || close(fds[i]) != 0)
+        exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child did not inherit descriptors\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(close(fds[i]) != 0){
+      printf("%s: close %d failed\n", s, fds[i]);
+      exit(1);
+    }
+  }
+}
+
 //
 // use sbrk() to count how many free physical memory pages there are.
 // touches the pages to force allocation.
@@ -2639,6 +2942,11 @@ main(int argc, char *argv[])
     char *s;
   } tests[] = {
     {execout, "execout"},
+    {nicetest, "nicetest"},
+    {affinitytest, "affinitytest"},
+    {schedstattest, "schedstattest"},
+    {manychildren, "manychildren"},
+    {manyfds, "manyfds"},
     {copyin, "copyin"},
     {copyout, "copyout"},
     {copyinstr1, "copyinstr1"},
@@ -2650,6 +2958,7 @@ main(int argc, char *argv[])
     {reparent2, "reparent2"},
     {pgbug, "pgbug" },
     {sbrkbugs, "sbrkbugs" },
+    {textwrite, "textwrite" },
     // {badwrite, "badwrite" },
     {badarg, "badarg" },
     {reparent, "reparent" },
@@ -2666,6 +2975,7 @@ main(int argc, char *argv[])
     {fourfiles, "fourfiles"},
     {sharedfd, "sharedfd"},
     {exectest, "exectest"},
+    {spawntest, "spawntest"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
@@ -36,3 +36,14 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("mmap");
+entry("munmap");
+entry("nice");
+entry("getprocs");
+entry("clone");
+entry("join");
+entry("futex");
+entry("setaffinity");
+entry("getaffinity");
+entry("spawn");
+entry("schedstat");
@@ -24,7 +24,6 @@ main(int argc, char *argv[])
 //   int fds[2];
 //   pipe(fds);
 //   close(fds[1]);
-  int pid;
 
   char *args[MAXARG];
   int i;
@@ -61,9 +60,10 @@ main(int argc, char *argv[])
 
     //    printf("the buff character %s\n", buf[n]);
 
-        pid = fork();
-        if (pid == 0) {
-            exec(argv[1], args);
+        // spawn() rather than fork() and exec(): no copy
+        // of xargs is made just to be thrown away.
+        if (spawn(argv[1], args, 0) < 0) {
+            fprintf(2, "xargs: exec %s failed\n", argv[1]);
         } else {
             wait(0);
         }